@@ -12,13 +12,41 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+// Archives & score indexes are read through memory mappings, score logs are appended to with plain descriptors
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <winioctl.h>
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 extern "C"
 {
 #include "./SDL2-2.0.10/include/SDL.h"
 #include "./SDL2-2.0.10/include/SDL_main.h"
+#include "./SDL2-2.0.10/include/SDL_bits.h"
 }
 
+// SSSE3 kernels are compiled on x86 and picked at runtime
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <tmmintrin.h>
+#define PALETTE_SSSE3
+#if defined(__GNUC__)
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define TARGET_SSSE3
+#endif
+#endif
+
 // --- CONFIGURATION ---
 // Screen dimensions
 #define WINDOW_WIDTH 1080
@@ -30,7 +58,7 @@ extern "C"
 #define PROGRESS_BAR_WIDTH 200
 #define PROGRESS_BAR_HEIGHT 20
 
-// Positioning of info panel, board edges & progress bar
+// Positioning of info panel, board view edges & progress bar
 #define INFO_PANEL_Y 0
 #define LEFT_EDGE ((WINDOW_WIDTH - BOARD_WIDTH) / 2)
 #define RIGHT_EDGE (LEFT_EDGE + BOARD_WIDTH)
@@ -38,20 +66,104 @@ extern "C"
 #define BOTTOM_EDGE (TOP_EDGE + BOARD_HEIGHT)
 #define PROGRESS_BAR_X ((WINDOW_WIDTH - PROGRESS_BAR_WIDTH) / 2)
 #define PROGRESS_BAR_Y (BOTTOM_EDGE + 10)
+#define SCRUBBER_Y (PROGRESS_BAR_Y + PROGRESS_BAR_HEIGHT + 8)  // Position in a watched replay, as wide as the board view
+#define SCRUBBER_HEIGHT 8
+#define SCRUBBER_MARGIN 6   // Clicks this close to the scrubber still grab it
+
+// Regions redrawn every frame: every cell of the view at the smallest zoom, the minimap, food, bonus, progress bar & scrubber
+#define MAX_DIRTY_RECTS ((BOARD_WIDTH / MIN_CELL_SIZE) * (BOARD_HEIGHT / MIN_CELL_SIZE) + MINIMAP_CELLS * MINIMAP_CELLS + 10)
 
 // Text settings
 #define INFO_PANEL_TEXT_Y 20
 #define INFO_PANEL_TEXT_SCALE 1
+#define INFO_FIELD_LENGTH 16 // Max characters of a single info panel value
+
+// Cell grid settings
+#define BOARD_COLUMNS (BOARD_WIDTH / SEGMENT_SIZE)  // Default board, exactly filling the view
+#define BOARD_ROWS (BOARD_HEIGHT / SEGMENT_SIZE)
+#define BOARD_MAX_SIZE 4096 // Cells across & down at most, per-cell buffers of the largest board stay far below 2 GB
+#define GRID_MAX_TEXEL_UPDATES 16   // More changed cells are uploaded as one bounding rectangle
+
+// Camera & minimap settings, used when the board is larger than the view
+#define ZOOM_LEVELS 3   // Cell size halves with every level
+#define MIN_CELL_SIZE (SEGMENT_SIZE >> (ZOOM_LEVELS - 1))
+#define OCCUPANCY_LEVELS 16 // Occupancy pyramid depth, boards up to 32768 cells wide
+#define MINIMAP_CELLS 64    // Minimap is the finest pyramid level at most this many cells wide
+#define MINIMAP_SIZE 128
+#define MINIMAP_X (RIGHT_EDGE + (WINDOW_WIDTH - RIGHT_EDGE - MINIMAP_SIZE) / 2)
+#define MINIMAP_Y TOP_EDGE
+
+// Terminal settings
+#define TERMINAL_LINE_LENGTH 96     // Longest status or message line
+#define TERMINAL_MESSAGE_LINES 4
+#define TERMINAL_BAR_WIDTH 20       // Characters of the bonus bar at its full length
+
+// Capture settings
+#define CAPTURE_BUFFERS 32  // Frames in flight between the renderer and the writer thread
+
+// Rectangle batch settings
+#define RECT_BATCH_COLORS 8
+
+// Rasterizer settings
+#define RASTER_TILE_WIDTH 256 // Wide tiles keep row copies long
+#define RASTER_TILE_HEIGHT 32
+#define RASTER_THREADS 1    // Default, 1 = draw directly on the main thread
+#define SNAPSHOT_FRESH 4  // Set in the shared slot index of the triple buffer until the renderer takes it
+#define BENCH_WIDTH 3840    // Resolution & length of the rasterizer benchmark
+#define BENCH_HEIGHT 2160
+#define BENCH_FRAMES 30
 #define GAME_OVER_TEXT_Y (WINDOW_HEIGHT / 2)
 #define GAME_OVER_TEXT_SCALE 2.5
 
 // Snake settings
-#define INITIAL_SNAKE_X (LEFT_EDGE + (BOARD_WIDTH / 2 / SEGMENT_SIZE) * SEGMENT_SIZE)   // Start in the middle of the board
-#define INITIAL_SNAKE_Y (TOP_EDGE + (BOARD_HEIGHT / 2 / SEGMENT_SIZE) * SEGMENT_SIZE)
+#define BEAD_INSET 4     // Narrow segments of the beads style lose this much on both sides
 #define INITIAL_SNAKE_LENGTH 3  // Number of segments
 #define INITIAL_SNAKE_MOVE_INTERVAL 200 // ms
 #define SPEED_UP_INTERVAL 7000 // ms
 #define SPEED_UP_FACTOR 0.9 // Range (0, 1) for increasing speed
+#define MIN_SNAKE_MOVE_INTERVAL 16 // ms, speed-ups stop at about a frame per move
+
+// Replay settings
+#define REPLAY_MAGIC "SNKR"
+#define REPLAY_VERSION 2
+#define REPLAY_HEADER_FIELDS 8
+#define REPLAY_KEYFRAME_INTERVAL 2048   // Ticks between full states, a seek plays at most this many
+#define REPLAY_SEEK_TICKS 50    // Ticks skipped by the arrow keys while watching
+#define REPLAY_MAX_LENGTH (1 << 28) // Bytes of a game's log & keyframes, a longer game is taken for a damaged one
+#define KEYFRAME_FIELDS 24      // Varints of a keyframe besides the snake's body
+#define KEYFRAME_STAY 4         // Body step of a segment on the same cell as the one before it
+#define VARINT_MAX_BYTES 5  // Of a 32-bit value
+
+// Archive settings
+#define ARCHIVE_MAGIC "SNKA"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_CAPACITY (1 << 22)  // Index records reserved in a new archive, the unused ones stay a hole in the sparse file
+#define ARCHIVE_LIST_LIMIT 20   // Matching games listed by a query
+
+// Analytics settings
+#define ANALYTICS_BUCKETS 33    // Of a histogram of 32-bit values: 0, 1, 2-3, 4-7 ...
+#define ANALYTICS_CHUNK 64      // Games an analysis thread claims at once
+
+// Score settings
+#define SCORE_LOG_PATH "scores.log" // Default, the top-K index is kept next to it
+#define SCORE_INDEX_SUFFIX ".top"
+#define SCORE_MAGIC 0x45524353      // "SCRE" at the start of every log record
+#define SCORE_INDEX_MAGIC "SNKT"
+#define SCORE_INDEX_VERSION 2
+#define SCORE_TOP_K 10  // Best scores kept per board
+#define SCORE_SHOWN 5   // Of them listed on the Game Over screen
+
+// Checkpoint settings
+#define CHECKPOINT_PATH "snake.sav" // Default, 's' saves the game to it & 'l' loads it back
+#define CHECKPOINT_MAGIC "SNKC"
+#define CHECKPOINT_VERSION 1
+
+// Telemetry settings
+#define TELEMETRY_MAGIC "SNKE"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_RING_SIZE 4096    // Events per ring, a power of two
+#define TELEMETRY_RINGS 4   // Threads that may emit events
+#define TELEMETRY_FLUSH_INTERVAL 250    // ms between drains of the rings
 
 // Food settings
 #define FOOD_POINTS 1
@@ -64,12 +176,19 @@ extern "C"
 #define BONUS_SLOW_DOWN_FACTOR 1.2 // Range (1, inf) for decreasing speed
 #define BONUS_POINTS 2
 
+// Frame pacing
+#define TARGET_FPS 60   // Default frame rate limit, 0 = unlimited
+#define SPIN_MARGIN 2   // ms before a deadline when sleeping turns into spinning
+
 // Colors
 #define BACKGROUND_COLOR 0x000000
 #define OUTLINE_COLOR 0xFFFFFF
 #define SNAKE_COLOR 0x00FF00
 #define FOOD_COLOR 0x0000FF
 #define BONUS_COLOR 0xFF0000
+#define TEXT_COLOR 0xFFFFFF
+#define NO_COLOR 0   // Outline or fill left out of a rectangle
+#define PALETTE_COLORS 6    // Colors of the indexed back buffer, at most 16
 
 // --- TYPE DEFINITIONS ---
 typedef enum
@@ -80,587 +199,7197 @@ typedef enum
     RIGHT
 } Direction;
 
+typedef enum
+{
+    PLAYING,
+    GAME_OVER
+} GameState;
+
 typedef struct
 {
     int x;
     int y;
 } Segment;
 
+typedef struct
+{
+    Uint8 rows[256][8]; // 1 bit per pixel, the leftmost pixel in the most significant bit
+} Font;
+
+typedef enum
+{
+    DRAW_RECTANGLE,
+    DRAW_CIRCLE,
+    DRAW_GLYPH,
+    DRAW_RUN
+} DrawCommandType;
+
+typedef struct
+{
+    DrawCommandType type;
+    SDL_Rect bounds;    // Every pixel drawn lies inside
+    Uint32 outlineColor;    // Rectangles only
+    Uint32 color;
+    const Font* font;   // Glyphs only
+    int glyph;
+    int phase;  // Runs only, parity of the cells drawn as big segments
+    int inset;  // Runs only, small segments are narrower by this on both sides
+    SDL_Rect clip;  // Pixels outside are left as they are
+} DrawCommand;
+
+typedef enum
+{
+    RENDER_NULL,
+    RENDER_SURFACE,
+    RENDER_GRID,
+    RENDER_RECTS,
+    RENDER_TERMINAL,
+    RENDER_CAPTURE
+} RenderMode;
+
+typedef enum
+{
+    CAPTURE_Y4M,    // YUV 4:2:0 video with a header
+    CAPTURE_RGB     // Raw packed RGB24 frames
+} CaptureFormat;
+
+typedef enum
+{
+    SNAKE_SOLID,    // Straight runs are single bars
+    SNAKE_BEADS     // Big segments alternate with narrow ones
+} SnakeStyle;
+
+typedef struct
+{
+    RenderMode renderMode;
+    SnakeStyle snakeStyle;
+    int targetFps;  // 0 = unlimited
+    int vsync;
+    int interpolate;    // Draw the snake between its last two positions
+    int threads;    // Rasterizer threads, 1 = draw directly on the main thread
+    int maxFrames;  // 0 = unlimited
+    int boardColumns;
+    int boardRows;
+    int renderThread;   // Draw & present on a separate thread, fed by snapshots
+    const char* capturePath;    // Video file written instead of showing a window, NULL = none
+    const char* fontPath;       // Charset bitmap printed as the CHARSET table instead of playing, NULL = none
+    const char* recordPath;     // Replay file every game is appended to, NULL = none
+    const char* replayPath;     // Replay file played back headless instead of a game, NULL = none
+    const char* watchPath;      // Replay file a game is watched from instead of played, NULL = none
+    const char* archivePath;    // Archive every game is appended to, or the one imported into, NULL = none
+    const char* importPath;     // Replay file appended to the archive instead of playing, NULL = none
+    const char* queryPath;      // Archive whose index is searched instead of playing, NULL = none
+    const char* analyzePath;    // Archive whose games are played for statistics instead of playing, NULL = none
+    const char* scoresPath;     // Score log of finished games, NULL = none
+    const char* checkpointPath; // Saved to with 's' & loaded from with 'l', NULL = none
+    const char* telemetryPath;  // Event stream of played games, NULL = none
+    int minScore;       // Filters of archived games
+    Uint32 minDuration; // ms
+    int watchGame;  // Number of the watched game in its file, from 1
+    Sint64 seed;    // Of the first game, -1 = random
+    int benchRaster;
+    int benchRender;
+    int benchStartup;   // Quit after the first frame and report how long it took to get there
+    Uint64 launchTime;  // Performance counter when the program started
+} Options;
+
+typedef enum
+{
+    FRAME_BOARD,    // Info panel, board & bonus progress bar
+    FRAME_MESSAGE   // Lines of text on an empty screen
+} FrameLayout;
+
+// Part of the board shown in the view
+typedef struct
+{
+    float column;   // Board cell in the top-left corner, may be fractional or negative
+    float row;
+    float columns;  // Cells in the view
+    float rows;
+    int cellSize;   // Pixels
+} Camera;
+
+// Everything a frame is drawn from, copied out of the game after each simulation step
+typedef struct
+{
+    GameState state;
+    Uint32 time;    // Of the simulation step
+    Uint32 startTime;
+    Uint32 nextTick;    // When the simulation changes on its own
+    int points;
+    Segment food;
+    Segment bonus;
+    int bonusActive;
+    Uint32 bonusTime;   // Start of the bonus
+    Uint32 moveTime;    // Of the last snake move
+    int moveInterval;
+    int length;
+    int capacity;   // Of both body arrays
+    Segment* body;
+    Segment* previous;  // Body before the last move
+    int columns;    // Board size
+    int rows;
+    int zoom;
+    Uint8* minimap; // Occupied cells of the downsampled board, room for MINIMAP_CELLS squared
+    int minimapColumns;
+    int minimapRows;
+    int minimapShift;   // A minimap cell covers 2^shift board cells across
+    int replayTick;     // Position in the watched replay
+    int replayTicks;    // Length of the watched replay, 0 when playing
+    int bestCount;      // Best scores of the board, listed on the Game Over screen
+    int best[SCORE_SHOWN];
+    int paused;         // Clock of the game, the render thread tells game time from it
+    Uint32 pauseTime;
+    Uint32 clockOffset;
+} Snapshot;
+
+// Recorded game, its input log follows it in the file
+typedef struct
+{
+    int columns;
+    int rows;
+    Uint32 seed;
+    int ticks;      // Steps of the whole game
+    int points;     // Final score, playback is checked against it
+    int logLength;  // Bytes of the input log
+    int keyframeInterval;   // Ticks between keyframes
+    int keyframeLength;     // Bytes of the keyframes, which follow the log
+} ReplayHeader;
+
+// Start of an archive, followed by `capacity` index records and then the payloads. Archives are in the
+// machine's byte order, so readers use the mapped header & records in place.
+typedef struct
+{
+    char magic[4];
+    Uint32 version;
+    Uint32 recordSize;  // Checked by readers against their ArchiveRecord
+    Uint32 capacity;
+    Uint64 count;       // Games appended, written after their payload & record
+    Uint64 end;         // Of the last payload
+} ArchiveHeader;
+
+// Entry of the score log, written with a single append. The checksum lets readers skip a record torn by a crash.
+typedef struct
+{
+    Uint32 magic;       // SCORE_MAGIC
+    Uint32 checksum;    // Of the fields after it
+    Uint32 columns;     // Board the game was played on
+    Uint32 rows;
+    Uint32 points;
+    Uint32 ticks;
+    Uint32 duration;    // ms of game time
+    Uint32 seed;
+    Sint64 time;        // Unix time the game ended
+} ScoreRecord;
+
+// Start of the top-K index, followed by one table per board. Like archives it is in the machine's byte order.
+typedef struct
+{
+    char magic[4];
+    Uint32 version;
+    Uint64 logSize;     // Bytes of the score log the index covers, reading resumes here
+    Uint64 scanned;     // Size of the log when last read, may pass logSize by a torn tail
+    Uint32 tables;
+    Uint32 topK;        // Entries per table, checked by readers
+} ScoreIndexHeader;
+
+typedef struct
+{
+    Uint32 columns;
+    Uint32 rows;
+    Uint32 count;
+    Uint32 reserved;
+    ScoreRecord best[SCORE_TOP_K];  // Highest first, equal scores in the order they were logged
+} ScoreTable;
+
+typedef enum
+{
+    EVENT_START,        // Value: seed
+    EVENT_FOOD,         // Food eaten, value: points
+    EVENT_BONUS_SPAWNED,    // Value: cell, row * columns + column
+    EVENT_BONUS_EXPIRED,
+    EVENT_SHRINK,       // Bonus taken, value: snake length
+    EVENT_SLOW_DOWN,    // Bonus taken, value: move interval
+    EVENT_SPEED_UP,     // Value: move interval
+    EVENT_DEATH         // Value: points
+} EventType;
+
+// Telemetry record, the file is a TelemetryHeader followed by records in the order rings were drained. Like archives
+// it is in the machine's byte order.
+typedef struct
+{
+    Uint32 tick;
+    Uint32 time;    // ms of game time
+    Uint16 type;    // EventType
+    Uint16 ring;    // Of the thread that emitted it
+    Sint32 value;
+} EventRecord;
+
+typedef struct
+{
+    char magic[4];
+    Uint32 version;
+    Uint32 recordSize;  // Checked by readers
+    Uint32 reserved;
+} TelemetryHeader;
+
+// Start of a checkpoint file, followed by the keyframe of the game. Like archives it is in the machine's byte order.
+typedef struct
+{
+    char magic[4];
+    Uint32 version;
+    Uint32 columns;     // Board the game is played on
+    Uint32 rows;
+    Uint32 size;        // Of the keyframe
+    Uint32 checksum;    // Of the keyframe
+} CheckpointHeader;
+
+typedef enum
+{
+    DEATH_TURNED,   // The snake ran into itself on the first move after a turn of the player
+    DEATH_EDGE,     // On a move the edge turned it
+    DEATH_STRAIGHT,
+    DEATH_NONE,     // The game was left before it ended
+    DEATH_CAUSES
+} DeathCause;
+
+// Statistics of the games of one board, added up per analysis thread & then across threads
+typedef struct
+{
+    Uint32 columns;
+    Uint32 rows;
+    Uint64 games;
+    Uint64 ticks;
+    Uint64 causes[DEATH_CAUSES];
+    Uint64 deathTicks[ANALYTICS_BUCKETS];   // Of the games that ended with a death
+    Uint64 scores[ANALYTICS_BUCKETS];
+    Uint64 lengths[ANALYTICS_BUCKETS];
+} BoardStats;
+
+// Index record of an archived game, its payload is the input log followed by the keyframes
+typedef struct
+{
+    Uint64 offset;      // Of the payload
+    Uint32 seed;
+    Uint32 points;
+    Uint32 ticks;
+    Uint32 duration;    // ms of game time
+    Uint32 length;      // Of the snake at the end
+    Uint32 logLength;
+    Uint32 keyframeLength;
+    Uint32 keyframeInterval;
+    Uint32 columns;
+    Uint32 rows;
+} ArchiveRecord;
+
 // --- UTILITY FUNCTIONS ---
-// Random integer from a closed interval <min, max>
-int RandomInt(int min, int max)
+// Xorshift generator, every game owns one so it can be replayed from its seed
+Uint32 NextRandom(Uint32* state)
 {
-    return rand() % (max - min + 1) + min;
+    Uint32 x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
 }
 
-// Get the starting x-coordinate for displaying centered text
-int CenterTextX(const char* text, float scale)
+// Generator state of a seed, the state must never be 0
+Uint32 SeedRandom(Uint32 seed)
 {
-	return (WINDOW_WIDTH - strlen(text) * 8 * scale) / 2;
+    Uint32 state = seed * 2654435761u + 1;
+    return state != 0 ? state : 1;
 }
 
-// --- DRAWING FUNCTIONS ---
-void DrawPixel(SDL_Surface* surface, int x, int y, Uint32 color)
+// Random integer from a closed interval <min, max>
+int RandomInt(Uint32* state, int min, int max)
 {
-    int bpp = surface->format->BytesPerPixel;
-    Uint8* p = (Uint8*)surface->pixels + y * surface->pitch + x * bpp;
-    *(Uint32*)p = color;
+    return NextRandom(state) % (max - min + 1) + min;
 }
 
-void DrawLine(SDL_Surface* screen, int x, int y, int length, int dx, int dy, Uint32 color)
+// Varints hold 7 bits per byte, lowest first, the top bit is set while more bytes follow
+int PutVarint(Uint8* out, Uint32 value)
 {
-    for (int i = 0; i < length; i++)
+    int length = 0;
+    while (value >= 0x80)
     {
-        DrawPixel(screen, x, y, color);
-        x += dx;
-        y += dy;
+        out[length++] = (Uint8)(value | 0x80);
+        value >>= 7;
     }
+    out[length++] = (Uint8)value;
+    return length;
 }
 
-void DrawRectangle(SDL_Surface* screen, int x, int y, int width, int height, Uint32 outlineColor, Uint32 fillColor)
+// Returns the number of bytes read, 0 if the input ends first
+int GetVarint(const Uint8* in, const Uint8* end, Uint32* value)
 {
-	if (outlineColor != NULL)   // Outline is optional
+    *value = 0;
+    for (int i = 0; i < VARINT_MAX_BYTES && in + i < end; i++)
     {
-        DrawLine(screen, x, y, height, 0, 1, outlineColor);
-        DrawLine(screen, x + width - 1, y, height, 0, 1, outlineColor);
-        DrawLine(screen, x, y, width, 1, 0, outlineColor);
-        DrawLine(screen, x, y + height - 1, width, 1, 0, outlineColor);
+        *value |= (Uint32)(in[i] & 0x7F) << (7 * i);
+        if ((in[i] & 0x80) == 0)
+        {
+            return i + 1;
+        }
     }
+    return 0;
+}
+
+// Next varint of a keyframe, reads as 0 past its end
+Uint32 TakeVarint(const Uint8** next, const Uint8* end)
+{
+    Uint32 value;
+    int read = GetVarint(*next, end, &value);
+    *next += read;
+    return read > 0 ? value : 0;
+}
 
-	if (fillColor != NULL)  // Fill is optional
+int ReadVarint(FILE* file, Uint32* value)
+{
+    Uint8 bytes[VARINT_MAX_BYTES];
+    int length = 0;
+    int c;
+    do
     {
-        for (int i = y + 1; i < y + height - 1; i++)
+        if (length == VARINT_MAX_BYTES || (c = fgetc(file)) == EOF)
         {
-            DrawLine(screen, x + 1, i, width - 2, 1, 0, fillColor);
+            return 0;
         }
-    }
+        bytes[length++] = (Uint8)c;
+    } while (c & 0x80);
+    return GetVarint(bytes, bytes + length, value) > 0;
 }
 
-void DrawCircle(SDL_Surface* screen, int cx, int cy, int radius, Uint32 color)
+// Replay files start with the magic & version, then hold games one after another: the header as varints, then the input log
+FILE* CreateReplayFile(const char* path)
 {
-    for (int y = -radius; y < radius; y++)
+    FILE* file = fopen(path, "wb");
+    if (file == NULL || fwrite(REPLAY_MAGIC, 1, 4, file) != 4 || fputc(REPLAY_VERSION, file) == EOF)
     {
-        for (int x = -radius; x < radius; x++)
+        printf("Can't create replay file %s\n", path);
+        if (file != NULL)
         {
-            if (x * x + y * y < radius * radius)
-            {
-                DrawPixel(screen, cx + x, cy + y, color);
-            }
+            fclose(file);
         }
+        return NULL;
     }
+    return file;
 }
 
-void DrawString(SDL_Surface* screen, int x, int y, const char* text, SDL_Surface* charset, float scale)
+FILE* OpenReplayFile(const char* path)
 {
-    int px, py, c;
-    SDL_Rect s, d;
-    s.w = 8;
-    s.h = 8;
-    d.w = 8 * scale;
-    d.h = 8 * scale;
-    while (*text)
+    char magic[5];
+    FILE* file = fopen(path, "rb");
+    if (file == NULL || fread(magic, 1, 5, file) != 5 || memcmp(magic, REPLAY_MAGIC, 4) != 0 || magic[4] != REPLAY_VERSION)
     {
-        c = *text & 255;
-        px = (c % 16) * 8;
-        py = (c / 16) * 8;
-        s.x = px;
-        s.y = py;
-        d.x = x;
-        d.y = y;
-        SDL_BlitScaled(charset, &s, screen, &d);
-        x += 8 * scale;
-        text++;
+        printf("%s is not a replay file of version %d\n", path, REPLAY_VERSION);
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+        return NULL;
     }
+    return file;
 }
 
-// --- CLASSES ---
-class Snake
+// Written in one go when a game ends and flushed, so a crash loses at most the game in progress
+int WriteReplay(FILE* file, const ReplayHeader* header, const Uint8* log, const Uint8* keyframes)
 {
-private:
-    int length;
-    Segment* body;
-	Segment* head;  // Pointer to body[0]
-    Direction direction;
-    Uint32 lastMoveTime;
-    int moveInterval;   // Speed
-    int mayChangeDirection; // Flag to prevent changing direction twice in one move
-
-    int IsOppositeDirection(Direction newDirection)
+    Uint8 bytes[REPLAY_HEADER_FIELDS * VARINT_MAX_BYTES];
+    Uint32 fields[REPLAY_HEADER_FIELDS] = { (Uint32)header->columns, (Uint32)header->rows, header->seed, (Uint32)header->ticks,
+        (Uint32)header->points, (Uint32)header->logLength, (Uint32)header->keyframeInterval, (Uint32)header->keyframeLength };
+    int length = 0;
+    for (int i = 0; i < REPLAY_HEADER_FIELDS; i++)
     {
-        return ((direction == UP && newDirection == DOWN) ||
-            (direction == DOWN && newDirection == UP) ||
-            (direction == LEFT && newDirection == RIGHT) ||
-            (direction == RIGHT && newDirection == LEFT)) ? 1 : 0;
+        length += PutVarint(bytes + length, fields[i]);
     }
+    return fwrite(bytes, 1, length, file) == (size_t)length && (int)fwrite(log, 1, header->logLength, file) == header->logLength &&
+        (int)fwrite(keyframes, 1, header->keyframeLength, file) == header->keyframeLength && fflush(file) == 0;
+}
 
-    int IsDirectionIntoEdge(Direction newDirection)
-    {
-        return ((newDirection == LEFT && head->x <= LEFT_EDGE) ||
-            (newDirection == RIGHT && head->x >= RIGHT_EDGE - SEGMENT_SIZE) ||
-            (newDirection == UP && head->y <= TOP_EDGE) ||
-            (newDirection == DOWN && head->y >= BOTTOM_EDGE - SEGMENT_SIZE)) ? 1 : 0;
-    }
+// Boards a game can be played on, recorded games are checked against it too
+int IsBoardSize(Uint32 columns, Uint32 rows)
+{
+    return columns >= BOARD_COLUMNS && columns <= BOARD_MAX_SIZE && rows >= BOARD_ROWS && rows <= BOARD_MAX_SIZE;
+}
 
-    void ChangeDirectionOnEdge()
+// Reads the log followed by the keyframes into one buffer, which grows as needed.
+// Returns 0 at the end of the file or on a damaged game: a field past an int (the seed aside), a board that can't be
+// played or a game longer than REPLAY_MAX_LENGTH.
+int ReadReplay(FILE* file, ReplayHeader* header, Uint8** data, int* capacity)
+{
+    Uint32 fields[REPLAY_HEADER_FIELDS];
+    for (int i = 0; i < REPLAY_HEADER_FIELDS; i++)
     {
-        if (direction == LEFT && head->x <= LEFT_EDGE)
-        {
-            direction = IsDirectionIntoEdge(UP) ? DOWN : UP;
-        }
-        else if (direction == RIGHT && head->x >= RIGHT_EDGE - SEGMENT_SIZE)
-        {
-            direction = IsDirectionIntoEdge(DOWN) ? UP : DOWN;
-        }
-        else if (direction == UP && head->y <= TOP_EDGE)
-        {
-            direction = IsDirectionIntoEdge(RIGHT) ? LEFT : RIGHT;
-        }
-        else if (direction == DOWN && head->y >= BOTTOM_EDGE - SEGMENT_SIZE)
+        if (ReadVarint(file, &fields[i]) == 0 || (i != 2 && fields[i] > SDL_MAX_SINT32))
         {
-            direction = IsDirectionIntoEdge(LEFT) ? RIGHT : LEFT;
+            return 0;
         }
     }
-
-public: 
-    ~Snake()
+    header->columns = (int)fields[0];
+    header->rows = (int)fields[1];
+    header->seed = fields[2];
+    header->ticks = (int)fields[3];
+    header->points = (int)fields[4];
+    header->logLength = (int)fields[5];
+    header->keyframeInterval = (int)fields[6];
+    header->keyframeLength = (int)fields[7];
+    Uint64 length = (Uint64)header->logLength + header->keyframeLength;
+    if (IsBoardSize(fields[0], fields[1]) == 0 || length > REPLAY_MAX_LENGTH)
     {
-        free(body);
+        return 0;
     }
-
-    void Initialize()
+    if (length > (Uint64)*capacity)
     {
-        length = INITIAL_SNAKE_LENGTH;
-        body = (Segment*)malloc(length * sizeof(Segment));
-        head = &body[0];
-        direction = RIGHT;
-        lastMoveTime = SDL_GetTicks();
-		moveInterval = INITIAL_SNAKE_MOVE_INTERVAL;
-		mayChangeDirection = 1;
-        for (int i = 0; i < length; i++)
+        Uint8* grown = (Uint8*)realloc(*data, (size_t)length);
+        if (grown == NULL)
         {
-            body[i].x = INITIAL_SNAKE_X - i * SEGMENT_SIZE;
-            body[i].y = INITIAL_SNAKE_Y;
+            return 0;
         }
+        *data = grown;
+        *capacity = (int)length;
     }
+    return fread(*data, 1, (size_t)length, file) == length;
+}
+
+// Archive offsets pass 2 GB
+int SeekFile(FILE* file, Uint64 offset)
+{
+#if defined(_WIN32)
+    return _fseeki64(file, (__int64)offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET);
+#endif
+}
+
+// Unwritten ranges of the file take no space on the disk. NTFS fills them with zeros unless the file is marked, the
+// file systems elsewhere leave holes on their own. 0 if the file system can't have holes, which only costs space.
+int MarkSparse(FILE* file)
+{
+#if defined(_WIN32)
+    DWORD returned;
+    return DeviceIoControl((HANDLE)_get_osfhandle(_fileno(file)), FSCTL_SET_SPARSE, NULL, 0, NULL, 0, &returned, NULL) != 0;
+#else
+    return file != NULL;
+#endif
+}
+
+// 0 for a missing file
+Uint64 FileSize(const char* path)
+{
+#if defined(_WIN32)
+    struct _stat64 status;
+    return _stat64(path, &status) == 0 ? (Uint64)status.st_size : 0;
+#else
+    struct stat status;
+    return stat(path, &status) == 0 ? (Uint64)status.st_size : 0;
+#endif
+}
+
+// Replaces the target in one step, readers see either the old file or the new one
+int RenameOver(const char* from, const char* to)
+{
+#if defined(_WIN32)
+    return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return rename(from, to) == 0;
+#endif
+}
+
+// Flushes the file down to the disk, not only to the system
+int SyncFile(FILE* file)
+{
+#if defined(_WIN32)
+    return fflush(file) == 0 && _commit(_fileno(file)) == 0;
+#else
+    return fflush(file) == 0 && fsync(fileno(file)) == 0;
+#endif
+}
 
-    void SetDirection(Direction newDirection)
+int ProcessId()
+{
+#if defined(_WIN32)
+    return _getpid();
+#else
+    return (int)getpid();
+#endif
+}
+
+// Every write of the descriptor goes to the end of the file in one piece, so processes can share it. The C runtime's
+// _O_APPEND on Windows seeks & writes in two steps, a handle with append access alone is appended to by the system.
+int OpenForAppend(const char* path)
+{
+#if defined(_WIN32)
+    HANDLE handle = CreateFileA(path, FILE_APPEND_DATA, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    int file = handle != INVALID_HANDLE_VALUE ? _open_osfhandle((intptr_t)handle, 0) : -1;  // Binary, no emulated append
+    if (handle != INVALID_HANDLE_VALUE && file < 0)
     {
-        if (mayChangeDirection && !IsOppositeDirection(newDirection) && !IsDirectionIntoEdge(newDirection))
-        {
-            direction = newDirection;
-			mayChangeDirection = 0;
-        }
+        CloseHandle(handle);
     }
+    return file;
+#else
+    return open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+#endif
+}
 
-    int CollidesWith(Segment segment)
+int AppendBytes(int file, const void* bytes, int length)
+{
+#if defined(_WIN32)
+    return _write(file, bytes, length) == length;
+#else
+    return write(file, bytes, length) == length;
+#endif
+}
+
+void CloseDescriptor(int file)
+{
+#if defined(_WIN32)
+    _close(file);
+#else
+    close(file);
+#endif
+}
+
+// FNV-1a, catches torn & damaged records
+Uint32 Checksum(const void* data, size_t length)
+{
+    const Uint8* bytes = (const Uint8*)data;
+    Uint32 hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
     {
-        for (int i = 0; i < length; i++)
-        {
-            if (body[i].x == segment.x && body[i].y == segment.y)
-            {
-                return 1;
-            }
-        }
-        return 0;
+        hash = (hash ^ bytes[i]) * 16777619u;
     }
+    return hash;
+}
 
-    int HeadCollidesWith(Segment segment)
+Uint32 ScoreChecksum(const ScoreRecord* record)
+{
+    return Checksum(&record->columns, sizeof(ScoreRecord) - offsetof(ScoreRecord, columns));
+}
+
+// Whole checkpoint in one read, NULL if the file is missing or damaged. The header is followed by the keyframe.
+CheckpointHeader* ReadCheckpoint(const char* path)
+{
+    size_t size = (size_t)FileSize(path);
+    FILE* file = size >= sizeof(CheckpointHeader) ? fopen(path, "rb") : NULL;
+    CheckpointHeader* header = file != NULL ? (CheckpointHeader*)malloc(size) : NULL;
+    int read = header != NULL && fread(header, 1, size, file) == size;
+    if (file != NULL)
     {
-        return (head->x == segment.x && head->y == segment.y) ? 1 : 0;
+        fclose(file);
     }
-
-    int SelfCollision()
+    if (read == 0 || memcmp(header->magic, CHECKPOINT_MAGIC, 4) != 0 || header->version != CHECKPOINT_VERSION ||
+        header->size != size - sizeof(CheckpointHeader) || header->checksum != Checksum(header + 1, header->size))
     {
-        for (int i = 1; i < length; i++)
-        {
-            if (HeadCollidesWith(body[i]))
-            {
-                return 1;
-            }
-        }
-        return 0;
+        free(header);
+        return NULL;
     }
+    return header;
+}
 
-    void Grow()
+// Bucket of a power-of-two histogram: 0, 1, 2-3, 4-7 ...
+int BucketOf(Uint32 value)
+{
+    return value == 0 ? 0 : SDL_MostSignificantBitIndex32(value) + 1;
+}
+
+int IsArchiveHeader(const ArchiveHeader* header)
+{
+    return memcmp(header->magic, ARCHIVE_MAGIC, 4) == 0 && header->version == ARCHIVE_VERSION &&
+        header->recordSize == sizeof(ArchiveRecord) && header->count <= header->capacity;
+}
+
+// Archives & replay files are told apart by their first bytes
+int HasMagic(const char* path, const char* magic)
+{
+    char bytes[4];
+    FILE* file = fopen(path, "rb");
+    int matches = file != NULL && fread(bytes, 1, 4, file) == 4 && memcmp(bytes, magic, 4) == 0;
+    if (file != NULL)
     {
-        length++;
-        body = (Segment*)realloc(body, length * sizeof(Segment));
-        body[length - 1] = body[length - 2];
-		head = &body[0];
+        fclose(file);
     }
+    return matches;
+}
 
-    void Shrink(int count)
+// Filters of queries & archive replays, they only read the index record
+int MatchesFilter(const ArchiveRecord* record, const Options* options)
+{
+    return (int)record->points >= options->minScore && record->duration >= options->minDuration;
+}
+
+RenderMode ParseRenderMode(const char* name)
+{
+    if (strcmp(name, "null") == 0)
     {
-        length -= count;
-        if (length < INITIAL_SNAKE_LENGTH)
-        {
-            length = INITIAL_SNAKE_LENGTH; // Minimum length
-        }
-        body = (Segment*)realloc(body, length * sizeof(Segment));
-        head = &body[0];
+        return RENDER_NULL;
     }
-
-    void Move(Uint32 currentTime)
+    if (strcmp(name, "grid") == 0)
     {
-		// Move snake with a fixed interval
-        if (currentTime - lastMoveTime >= moveInterval)
-        {
-            ChangeDirectionOnEdge();
-
-            for (int i = length - 1; i > 0; i--)
-            {
+        return RENDER_GRID;
+    }
+    if (strcmp(name, "terminal") == 0)
+    {
+        return RENDER_TERMINAL;
+    }
+    return strcmp(name, "rects") == 0 ? RENDER_RECTS : RENDER_SURFACE;
+}
+
+int EndsWith(const char* text, const char* suffix)
+{
+    int length = strlen(text), suffixLength = strlen(suffix);
+    return length >= suffixLength && strcmp(text + length - suffixLength, suffix) == 0;
+}
+
+// Captured video runs at the frame rate limit
+int CaptureFps(Options options)
+{
+    return options.targetFps > 0 ? options.targetFps : TARGET_FPS;
+}
+
+// Board size given as COLUMNSxROWS, from the view's size up to BOARD_MAX_SIZE either way
+void ParseBoardSize(const char* value, Options* options)
+{
+    int columns, rows;
+    if (sscanf(value, "%dx%d", &columns, &rows) == 2)
+    {
+        options->boardColumns = SDL_min(SDL_max(columns, BOARD_COLUMNS), BOARD_MAX_SIZE);
+        options->boardRows = SDL_min(SDL_max(rows, BOARD_ROWS), BOARD_MAX_SIZE);
+    }
+}
+
+// Options without a value, returns 0 if the argument is not one of them
+int ParseFlag(const char* arg, Options* options)
+{
+    if (strcmp(arg, "--no-vsync") == 0)
+    {
+        options->vsync = 0;
+    }
+    else if (strcmp(arg, "--no-interpolation") == 0)
+    {
+        options->interpolate = 0;
+    }
+    else if (strcmp(arg, "--render-thread") == 0)
+    {
+        options->renderThread = 1;
+    }
+    else if (strcmp(arg, "--no-scores") == 0)
+    {
+        options->scoresPath = NULL;
+    }
+    else if (strcmp(arg, "--bench-raster") == 0)
+    {
+        options->benchRaster = 1;
+    }
+    else if (strcmp(arg, "--bench-render") == 0)
+    {
+        options->benchRender = 1;
+    }
+    else if (strcmp(arg, "--bench-startup") == 0)
+    {
+        options->benchStartup = 1;
+        options->maxFrames = 1;
+    }
+    else
+    {
+        return 0;
+    }
+    return 1;
+}
+
+// Options of game archives, returns 0 if the argument is not one of them
+int ParseArchiveValue(const char* arg, const char* value, Options* options)
+{
+    if (strcmp(arg, "--archive") == 0)
+    {
+        options->archivePath = value;
+    }
+    else if (strcmp(arg, "--import") == 0)
+    {
+        options->importPath = value;
+    }
+    else if (strcmp(arg, "--query") == 0)
+    {
+        options->queryPath = value;
+    }
+    else if (strcmp(arg, "--analyze") == 0)
+    {
+        options->analyzePath = value;
+    }
+    else if (strcmp(arg, "--scores") == 0)
+    {
+        options->scoresPath = value;
+    }
+    else if (strcmp(arg, "--checkpoint") == 0)
+    {
+        options->checkpointPath = value;
+    }
+    else if (strcmp(arg, "--telemetry") == 0)
+    {
+        options->telemetryPath = value;
+    }
+    else if (strcmp(arg, "--min-score") == 0)
+    {
+        options->minScore = atoi(value);
+    }
+    else if (strcmp(arg, "--min-time") == 0)
+    {
+        options->minDuration = (Uint32)(atof(value) * 1000);
+    }
+    else
+    {
+        return 0;
+    }
+    return 1;
+}
+
+// Options of recording & replaying games, returns 0 if the argument is not one of them
+int ParseReplayValue(const char* arg, const char* value, Options* options)
+{
+    if (strcmp(arg, "--record") == 0)
+    {
+        options->recordPath = value;
+    }
+    else if (strcmp(arg, "--replay") == 0)
+    {
+        options->replayPath = value;
+    }
+    else if (strcmp(arg, "--seed") == 0)
+    {
+        options->seed = strtoul(value, NULL, 10);
+    }
+    else if (strcmp(arg, "--watch") == 0)
+    {
+        options->watchPath = value;
+    }
+    else if (strcmp(arg, "--game") == 0)
+    {
+        options->watchGame = SDL_max(atoi(value), 1);
+    }
+    else
+    {
+        return ParseArchiveValue(arg, value, options);
+    }
+    return 1;
+}
+
+// Options followed by a value, returns 0 if the argument is not one of them
+int ParseValue(const char* arg, const char* value, Options* options)
+{
+    if (strcmp(arg, "--fps") == 0)
+    {
+        options->targetFps = atoi(value);
+    }
+    else if (strcmp(arg, "--render") == 0)
+    {
+        options->renderMode = ParseRenderMode(value);
+    }
+    else if (strcmp(arg, "--snake") == 0)
+    {
+        options->snakeStyle = strcmp(value, "beads") == 0 ? SNAKE_BEADS : SNAKE_SOLID;
+    }
+    else if (strcmp(arg, "--frames") == 0)
+    {
+        options->maxFrames = atoi(value);
+    }
+    else if (strcmp(arg, "--threads") == 0)
+    {
+        options->threads = atoi(value);
+    }
+    else if (strcmp(arg, "--board") == 0)
+    {
+        ParseBoardSize(value, options);
+    }
+    else if (strcmp(arg, "--capture") == 0)
+    {
+        options->capturePath = value;
+    }
+    else if (strcmp(arg, "--font-table") == 0)
+    {
+        options->fontPath = value;
+    }
+    else
+    {
+        return ParseReplayValue(arg, value, options);
+    }
+    return 1;
+}
+
+// Recording, replaying, archiving & telemetry are off, the first game gets a random seed. Scores & checkpoints go to their default files.
+void SetReplayDefaults(Options* options)
+{
+    options->recordPath = NULL;
+    options->replayPath = NULL;
+    options->watchPath = NULL;
+    options->watchGame = 1;
+    options->archivePath = NULL;
+    options->importPath = NULL;
+    options->queryPath = NULL;
+    options->analyzePath = NULL;
+    options->minScore = 0;
+    options->minDuration = 0;
+    options->seed = -1;
+    options->scoresPath = SCORE_LOG_PATH;
+    options->checkpointPath = CHECKPOINT_PATH;
+    options->telemetryPath = NULL;
+}
+
+// No benchmark is run instead of the game
+void SetBenchmarkDefaults(Options* options)
+{
+    options->benchRaster = 0;
+    options->benchRender = 0;
+    options->benchStartup = 0;
+}
+
+// Read command line options, unknown ones are ignored
+void ParseOptions(int argc, char** argv, Options* options)
+{
+    options->renderMode = RENDER_SURFACE;
+    options->snakeStyle = SNAKE_SOLID;
+    options->targetFps = TARGET_FPS;
+    options->vsync = 1;
+    options->interpolate = 1;
+    options->threads = RASTER_THREADS;
+    options->maxFrames = 0;
+    options->boardColumns = BOARD_COLUMNS;
+    options->boardRows = BOARD_ROWS;
+    options->renderThread = 0;
+    options->capturePath = NULL;
+    options->fontPath = NULL;
+    SetReplayDefaults(options);
+    SetBenchmarkDefaults(options);
+    for (int i = 1; i < argc; i++)
+    {
+        if (ParseFlag(argv[i], options) == 0 && i + 1 < argc && ParseValue(argv[i], argv[i + 1], options))
+        {
+            i++;
+        }
+    }
+
+    if (options->capturePath != NULL)  // Captured frames are drawn on the main thread in step with the simulation
+    {
+        options->renderMode = RENDER_CAPTURE;
+        options->renderThread = 0;
+    }
+    if (options->watchPath != NULL)  // Watched games are not recorded or scored again
+    {
+        options->recordPath = NULL;
+        options->archivePath = NULL;
+        options->scoresPath = NULL;
+    }
+}
+
+// Board cell of a game coordinate, cells may be fractional. Game coordinates place the board at
+// SEGMENT_SIZE per cell from the view's corner, however much of it the camera shows.
+float CellColumn(int x)
+{
+    return (float)(x - LEFT_EDGE) / SEGMENT_SIZE;
+}
+
+float CellRow(int y)
+{
+    return (float)(y - TOP_EDGE) / SEGMENT_SIZE;
+}
+
+// Window pixel of a board cell seen through the camera
+int CellX(const Camera* camera, float column)
+{
+    return LEFT_EDGE + (int)SDL_floorf((column - camera->column) * camera->cellSize + 0.5f);
+}
+
+int CellY(const Camera* camera, float row)
+{
+    return TOP_EDGE + (int)SDL_floorf((row - camera->row) * camera->cellSize + 0.5f);
+}
+
+// Camera showing the default board exactly as it fits the view
+Camera FullView()
+{
+    Camera camera = { 0, 0, (float)BOARD_COLUMNS, (float)BOARD_ROWS, SEGMENT_SIZE };
+    return camera;
+}
+
+// Get the starting x-coordinate for displaying centered text
+int CenterTextX(const char* text, float scale)
+{
+	return (WINDOW_WIDTH - strlen(text) * 8 * scale) / 2;
+}
+
+// Write an unsigned integer as decimal digits, returns the number of characters written
+int FormatUInt(char* out, Uint32 value)
+{
+    char digits[10];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value > 0);
+
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = digits[count - 1 - i];
+    }
+    out[count] = '\0';
+    return count;
+}
+
+// Write milliseconds as seconds with two decimal places, e.g. "12.34"
+int FormatSeconds(char* out, Uint32 ms)
+{
+    Uint32 hundredths = ms / 10;
+    int length = FormatUInt(out, hundredths / 100);
+    out[length++] = '.';
+    out[length++] = '0' + hundredths / 10 % 10;
+    out[length++] = '0' + hundredths % 10;
+    out[length] = '\0';
+    return length;
+}
+
+// --- CHARSET ---
+
+// The 8x8 glyphs of cs8x8.bmp, 16x16 characters in code page 437 order, printed by --font-table cs8x8.bmp
+constexpr Font CHARSET =
+{ {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x7E, 0x81, 0xA5, 0x81, 0xA5, 0x99, 0x81, 0x7E },
+    { 0x7E, 0xFF, 0xDB, 0xFF, 0xDB, 0xE7, 0xFF, 0x7E },
+    { 0x66, 0xFF, 0xFF, 0xFF, 0xFF, 0x7E, 0x3C, 0x18 },
+    { 0x10, 0x38, 0x7C, 0xFE, 0xFE, 0x7C, 0x38, 0x10 },
+    { 0x38, 0x38, 0x10, 0xD6, 0xFE, 0xD6, 0x10, 0x7C },
+    { 0x10, 0x38, 0x7C, 0xFE, 0xFE, 0x7C, 0x10, 0x7C },
+    { 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xE7, 0xE7, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x18, 0x24, 0x24, 0x18, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xE7, 0xDB, 0xDB, 0xE7, 0xFF, 0xFF },
+    { 0x38, 0x18, 0x28, 0x40, 0xF0, 0x88, 0x88, 0x70 },
+    { 0x38, 0x44, 0x44, 0x44, 0x38, 0x10, 0x38, 0x10 },
+    { 0x18, 0x1C, 0x14, 0x14, 0x10, 0x10, 0x70, 0x60 },
+    { 0x0E, 0x32, 0x2E, 0x32, 0x22, 0x22, 0xEE, 0xCC },
+    { 0x00, 0x54, 0x38, 0x44, 0x44, 0x38, 0x54, 0x00 },
+    { 0x00, 0x60, 0x78, 0x7E, 0x78, 0x60, 0x00, 0x00 },
+    { 0x00, 0x06, 0x1E, 0x7E, 0x1E, 0x06, 0x00, 0x00 },
+    { 0x10, 0x38, 0x54, 0x10, 0x54, 0x38, 0x10, 0x00 },
+    { 0x6C, 0x6C, 0x6C, 0x6C, 0x6C, 0x00, 0x6C, 0x00 },
+    { 0x7C, 0xE4, 0xE4, 0x64, 0x24, 0x24, 0x24, 0x00 },
+    { 0x38, 0x44, 0x30, 0x28, 0x18, 0x44, 0x38, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0xFE, 0xFE, 0x00 },
+    { 0x10, 0x38, 0x7C, 0x10, 0x10, 0x7C, 0x38, 0x10 },
+    { 0x10, 0x38, 0x7C, 0x10, 0x10, 0x10, 0x10, 0x10 },
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x7C, 0x38, 0x10 },
+    { 0x00, 0x20, 0x60, 0xFF, 0x60, 0x20, 0x00, 0x00 },
+    { 0x00, 0x04, 0x06, 0xFF, 0x06, 0x04, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x20, 0x3C, 0x00, 0x00 },
+    { 0x00, 0x24, 0x66, 0xFF, 0x66, 0x24, 0x00, 0x00 },
+    { 0x00, 0x10, 0x10, 0x38, 0x38, 0x7C, 0x7C, 0x00 },
+    { 0x00, 0x7C, 0x7C, 0x38, 0x38, 0x10, 0x10, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, //  
+    { 0x30, 0x78, 0x78, 0x30, 0x30, 0x00, 0x30, 0x00 }, // !
+    { 0x6C, 0x6C, 0x6C, 0x00, 0x00, 0x00, 0x00, 0x00 }, // "
+    { 0x6C, 0x6C, 0xFE, 0x6C, 0xFE, 0x6C, 0x6C, 0x00 }, // #
+    { 0x30, 0x7C, 0xC0, 0x78, 0x0C, 0xF8, 0x30, 0x00 }, // $
+    { 0x00, 0xC6, 0xCC, 0x18, 0x30, 0x66, 0xC6, 0x00 }, // %
+    { 0x38, 0x6C, 0x38, 0x76, 0xDC, 0xCC, 0x76, 0x00 }, // &
+    { 0x60, 0x60, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00 }, // '
+    { 0x10, 0x30, 0x60, 0x60, 0x60, 0x30, 0x18, 0x00 }, // (
+    { 0x60, 0x30, 0x18, 0x18, 0x18, 0x30, 0x60, 0x00 }, // )
+    { 0x00, 0x66, 0x3C, 0xFF, 0x3C, 0x66, 0x00, 0x00 }, // *
+    { 0x00, 0x30, 0x30, 0xFC, 0x30, 0x30, 0x00, 0x00 }, // +
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x60 }, // ,
+    { 0x00, 0x00, 0x00, 0xFC, 0x00, 0x00, 0x00, 0x00 }, // -
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x30, 0x00 }, // .
+    { 0x06, 0x0C, 0x18, 0x30, 0x60, 0xC0, 0x80, 0x00 }, // /
+    { 0x7C, 0xC6, 0xCE, 0xDE, 0xF6, 0xE6, 0x7C, 0x00 }, // 0
+    { 0x30, 0x70, 0x30, 0x30, 0x30, 0x30, 0xFC, 0x00 }, // 1
+    { 0x78, 0xCC, 0x0C, 0x38, 0x60, 0xCC, 0xFC, 0x00 }, // 2
+    { 0x78, 0xCC, 0x0C, 0x38, 0x0C, 0xCC, 0x78, 0x00 }, // 3
+    { 0x1C, 0x3C, 0x6C, 0xCC, 0xFE, 0x0C, 0x1E, 0x00 }, // 4
+    { 0xFC, 0xC0, 0xF8, 0x0C, 0x0C, 0xCC, 0x78, 0x00 }, // 5
+    { 0x38, 0x60, 0xC0, 0xF8, 0xCC, 0xCC, 0x78, 0x00 }, // 6
+    { 0xFC, 0xCC, 0x0C, 0x18, 0x30, 0x30, 0x30, 0x00 }, // 7
+    { 0x78, 0xCC, 0xCC, 0x78, 0xCC, 0xCC, 0x78, 0x00 }, // 8
+    { 0x78, 0xCC, 0xCC, 0x7C, 0x0C, 0x18, 0x70, 0x00 }, // 9
+    { 0x00, 0x30, 0x30, 0x00, 0x00, 0x30, 0x30, 0x00 }, // :
+    { 0x00, 0x30, 0x30, 0x00, 0x00, 0x30, 0x30, 0x60 }, // ;
+    { 0x18, 0x30, 0x60, 0xC0, 0x60, 0x30, 0x18, 0x00 }, // <
+    { 0x00, 0x00, 0xFC, 0x00, 0x00, 0xFC, 0x00, 0x00 }, // =
+    { 0x60, 0x30, 0x18, 0x0C, 0x18, 0x30, 0x60, 0x00 }, // >
+    { 0x78, 0xCC, 0x0C, 0x18, 0x30, 0x00, 0x30, 0x00 }, // ?
+    { 0x7C, 0xC6, 0xDE, 0xDE, 0xDE, 0xC0, 0x78, 0x00 }, // @
+    { 0x30, 0x78, 0xCC, 0xCC, 0xFC, 0xCC, 0xCC, 0x00 }, // A
+    { 0xFC, 0x66, 0x66, 0x7C, 0x66, 0x66, 0xFC, 0x00 }, // B
+    { 0x3C, 0x66, 0xC0, 0xC0, 0xC0, 0x66, 0x3C, 0x00 }, // C
+    { 0xF8, 0x6C, 0x66, 0x66, 0x66, 0x6C, 0xF8, 0x00 }, // D
+    { 0xFE, 0x62, 0x68, 0x78, 0x68, 0x62, 0xFE, 0x00 }, // E
+    { 0xFE, 0x62, 0x68, 0x78, 0x68, 0x60, 0xF0, 0x00 }, // F
+    { 0x3C, 0x66, 0xC0, 0xC0, 0xCE, 0x66, 0x3E, 0x00 }, // G
+    { 0xCC, 0xCC, 0xCC, 0xFC, 0xCC, 0xCC, 0xCC, 0x00 }, // H
+    { 0x78, 0x30, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00 }, // I
+    { 0x1E, 0x0C, 0x0C, 0x0C, 0xCC, 0xCC, 0x78, 0x00 }, // J
+    { 0xE6, 0x66, 0x6C, 0x78, 0x6C, 0x66, 0xE6, 0x00 }, // K
+    { 0xF0, 0x60, 0x60, 0x60, 0x62, 0x66, 0xFE, 0x00 }, // L
+    { 0xC6, 0xEE, 0xFE, 0xFE, 0xD6, 0xC6, 0xC6, 0x00 }, // M
+    { 0xC6, 0xE6, 0xF6, 0xDE, 0xCE, 0xC6, 0xC6, 0x00 }, // N
+    { 0x38, 0x6C, 0xC6, 0xC6, 0xC6, 0x6C, 0x38, 0x00 }, // O
+    { 0xFC, 0x66, 0x66, 0x7C, 0x60, 0x60, 0xF0, 0x00 }, // P
+    { 0x78, 0xCC, 0xCC, 0xCC, 0xDC, 0x78, 0x1C, 0x00 }, // Q
+    { 0xFC, 0x66, 0x66, 0x7C, 0x6C, 0x66, 0xE6, 0x00 }, // R
+    { 0x78, 0xCC, 0xE0, 0x70, 0x1C, 0xCC, 0x78, 0x00 }, // S
+    { 0xFC, 0xB4, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00 }, // T
+    { 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0xFC, 0x00 }, // U
+    { 0xCC, 0xCC, 0xCC, 0xCC, 0xCC, 0x78, 0x30, 0x00 }, // V
+    { 0xC6, 0xC6, 0xC6, 0xD6, 0xFE, 0xEE, 0xC6, 0x00 }, // W
+    { 0xC6, 0xC6, 0x6C, 0x38, 0x38, 0x6C, 0xC6, 0x00 }, // X
+    { 0xCC, 0xCC, 0xCC, 0x78, 0x30, 0x30, 0x78, 0x00 }, // Y
+    { 0xFE, 0xC6, 0x8C, 0x18, 0x32, 0x66, 0xFE, 0x00 }, // Z
+    { 0x78, 0x60, 0x60, 0x60, 0x60, 0x60, 0x78, 0x00 }, // [
+    { 0xC0, 0x60, 0x30, 0x18, 0x0C, 0x06, 0x02, 0x00 },
+    { 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0x78, 0x00 }, // ]
+    { 0x10, 0x38, 0x6C, 0xC6, 0x00, 0x00, 0x00, 0x00 }, // ^
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xFE }, // _
+    { 0x30, 0x30, 0x18, 0x00, 0x00, 0x00, 0x00, 0x00 }, // `
+    { 0x00, 0x00, 0x78, 0x0C, 0x7C, 0xCC, 0x76, 0x00 }, // a
+    { 0xE0, 0x60, 0x60, 0x7C, 0x66, 0x66, 0xDC, 0x00 }, // b
+    { 0x00, 0x00, 0x78, 0xCC, 0xC0, 0xCC, 0x78, 0x00 }, // c
+    { 0x1C, 0x0C, 0x0C, 0x7C, 0xCC, 0xCC, 0x76, 0x00 }, // d
+    { 0x00, 0x00, 0x78, 0xCC, 0xFC, 0xC0, 0x78, 0x00 }, // e
+    { 0x38, 0x6C, 0x60, 0xF0, 0x60, 0x60, 0xF0, 0x00 }, // f
+    { 0x00, 0x00, 0x76, 0xCC, 0xCC, 0x7C, 0x0C, 0xF8 }, // g
+    { 0xE0, 0x60, 0x6C, 0x76, 0x66, 0x66, 0xE6, 0x00 }, // h
+    { 0x30, 0x00, 0x70, 0x30, 0x30, 0x30, 0x78, 0x00 }, // i
+    { 0x0C, 0x00, 0x0C, 0x0C, 0x0C, 0xCC, 0xCC, 0x78 }, // j
+    { 0xE0, 0x60, 0x66, 0x6C, 0x78, 0x6C, 0xE6, 0x00 }, // k
+    { 0x70, 0x30, 0x30, 0x30, 0x30, 0x30, 0x78, 0x00 }, // l
+    { 0x00, 0x00, 0xCC, 0xFE, 0xFE, 0xD6, 0xC6, 0x00 }, // m
+    { 0x00, 0x00, 0xF8, 0xCC, 0xCC, 0xCC, 0xCC, 0x00 }, // n
+    { 0x00, 0x00, 0x78, 0xCC, 0xCC, 0xCC, 0x78, 0x00 }, // o
+    { 0x00, 0x00, 0xDC, 0x66, 0x66, 0x7C, 0x60, 0xF0 }, // p
+    { 0x00, 0x00, 0x76, 0xCC, 0xCC, 0x7C, 0x0C, 0x1E }, // q
+    { 0x00, 0x00, 0xDC, 0x76, 0x66, 0x60, 0xF0, 0x00 }, // r
+    { 0x00, 0x00, 0x7C, 0xC0, 0x78, 0x0C, 0xF8, 0x00 }, // s
+    { 0x10, 0x30, 0x7C, 0x30, 0x30, 0x34, 0x18, 0x00 }, // t
+    { 0x00, 0x00, 0xCC, 0xCC, 0xCC, 0xCC, 0x76, 0x00 }, // u
+    { 0x00, 0x00, 0xCC, 0xCC, 0xCC, 0x78, 0x30, 0x00 }, // v
+    { 0x00, 0x00, 0xC6, 0xD6, 0xFE, 0xFE, 0x6C, 0x00 }, // w
+    { 0x00, 0x00, 0xC6, 0x6C, 0x38, 0x6C, 0xC6, 0x00 }, // x
+    { 0x00, 0x00, 0xCC, 0xCC, 0xCC, 0x7C, 0x0C, 0xF8 }, // y
+    { 0x00, 0x00, 0xFC, 0x98, 0x30, 0x64, 0xFC, 0x00 }, // z
+    { 0x1C, 0x30, 0x30, 0xE0, 0x30, 0x30, 0x1C, 0x00 }, // {
+    { 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x00 }, // |
+    { 0xE0, 0x30, 0x30, 0x1C, 0x30, 0x30, 0xE0, 0x00 }, // }
+    { 0x76, 0xDC, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ~
+    { 0x00, 0x10, 0x38, 0x6C, 0xC6, 0xC6, 0xC6, 0xFE },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x88, 0x22, 0x88, 0x22, 0x88, 0x22, 0x88, 0x00 },
+    { 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55, 0xAA, 0x55 },
+    { 0x77, 0xDD, 0x77, 0xDD, 0x77, 0xDD, 0x77, 0xDD },
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 },
+    { 0x10, 0x10, 0x10, 0xF0, 0x10, 0x10, 0x10, 0x10 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x28, 0x28, 0xE8, 0x08, 0xE8, 0x28, 0x28, 0x28 },
+    { 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28 },
+    { 0x00, 0x00, 0xF8, 0x08, 0xE8, 0x28, 0x28, 0x28 },
+    { 0x28, 0x28, 0xE8, 0x08, 0xF8, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0xF0, 0x10, 0x10, 0x10, 0x10 },
+    { 0x10, 0x10, 0x10, 0x1F, 0x00, 0x00, 0x00, 0x00 },
+    { 0x10, 0x10, 0x10, 0xFF, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0xFF, 0x10, 0x10, 0x10, 0x10 },
+    { 0x10, 0x10, 0x10, 0x1F, 0x10, 0x10, 0x10, 0x10 },
+    { 0x00, 0x00, 0x00, 0xFF, 0x00, 0x00, 0x00, 0x00 },
+    { 0x10, 0x10, 0x10, 0xFF, 0x10, 0x10, 0x10, 0x10 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x28, 0x28, 0x2F, 0x20, 0x3F, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x3F, 0x20, 0x2F, 0x28, 0x28, 0x28 },
+    { 0x28, 0x28, 0xEF, 0x00, 0xFF, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0xFF, 0x00, 0xEF, 0x28, 0x28, 0x28 },
+    { 0x28, 0x28, 0x2F, 0x20, 0x2F, 0x28, 0x28, 0x28 },
+    { 0x00, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0x00, 0x00 },
+    { 0x28, 0x28, 0xEF, 0x00, 0xEF, 0x28, 0x28, 0x28 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x10, 0x10, 0x10, 0xF0, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x1F, 0x10, 0x10, 0x10, 0x10 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0, 0xF0 },
+    { 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF },
+    { 0x70, 0x50, 0x70, 0x00, 0x00, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x18, 0x18, 0x00, 0x00, 0x00 },
+    { 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00 },
+    { 0x0F, 0x08, 0x08, 0x90, 0x90, 0x50, 0x50, 0x20 },
+    { 0x00, 0x60, 0x50, 0x50, 0x50, 0x00, 0x00, 0x00 },
+    { 0x70, 0x10, 0x70, 0x40, 0x70, 0x00, 0x00, 0x00 },
+    { 0x00, 0x7C, 0x7C, 0x7C, 0x7C, 0x7C, 0x7C, 0x00 },
+    { 0x00, 0x7C, 0x44, 0x44, 0x44, 0x44, 0x7C, 0x00 },
+} };
+
+// --- DRAWING FUNCTIONS ---
+// Surface in the format of the screen texture
+SDL_Surface* CreateSurface(int width, int height)
+{
+    return SDL_CreateRGBSurface(0, width, height, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
+}
+
+// Every color the game draws, index 0 is the background
+const Uint32 PALETTE[PALETTE_COLORS] = { BACKGROUND_COLOR, OUTLINE_COLOR, SNAKE_COLOR, FOOD_COLOR, BONUS_COLOR, TEXT_COLOR };
+SDL_COMPILE_TIME_ASSERT(palette, PALETTE_COLORS <= 16);
+
+// Index of a color in the palette, colors missing from it map to the background
+Uint32 PaletteIndex(Uint32 color)
+{
+    for (int i = 0; i < PALETTE_COLORS; i++)
+    {
+        if (PALETTE[i] == (color & 0xFFFFFF))
+        {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Pixel formats the primitives are compiled for, each names its storage type and maps 0xRRGGBB colors to it
+struct FormatIndexed8
+{
+    typedef Uint8 Pixel;
+    static Pixel Map(Uint32 color) { return (Pixel)PaletteIndex(color); }
+};
+
+struct FormatRGB565
+{
+    typedef Uint16 Pixel;
+    static Pixel Map(Uint32 color) { return (Pixel)(((color >> 8) & 0xF800) | ((color >> 5) & 0x07E0) | ((color >> 3) & 0x001F)); }
+};
+
+struct FormatARGB8888
+{
+    typedef Uint32 Pixel;
+    static Pixel Map(Uint32 color) { return color; }
+};
+
+// Pixel value of a color in the format of a surface, 8-bit surfaces hold palette indices
+Uint32 MapColor(const SDL_Surface* surface, Uint32 color)
+{
+    switch (surface->format->BytesPerPixel)
+    {
+        case 1:
+            return FormatIndexed8::Map(color);
+        case 2:
+            return FormatRGB565::Map(color);
+        default:
+            return FormatARGB8888::Map(color);
+    }
+}
+
+// 16-bit back buffer for low-bandwidth targets, half the bytes of a 32-bit one
+SDL_Surface* CreateRGB565Surface(int width, int height)
+{
+    return SDL_CreateRGBSurface(0, width, height, 16, 0xF800, 0x07E0, 0x001F, 0);
+}
+
+// 8-bit back buffer, a quarter of the bytes of a 32-bit one
+SDL_Surface* CreateIndexedSurface(int width, int height)
+{
+    SDL_Surface* surface = SDL_CreateRGBSurface(0, width, height, 8, 0, 0, 0, 0);
+    if (surface != NULL)
+    {
+        SDL_Color colors[PALETTE_COLORS];
+        for (int i = 0; i < PALETTE_COLORS; i++)
+        {
+            colors[i].r = (PALETTE[i] >> 16) & 0xFF;
+            colors[i].g = (PALETTE[i] >> 8) & 0xFF;
+            colors[i].b = PALETTE[i] & 0xFF;
+            colors[i].a = 255;
+        }
+        SDL_SetPaletteColors(surface->format->palette, colors, 0, PALETTE_COLORS);
+    }
+    return surface;
+}
+
+// Clip rectangle that cuts nothing
+SDL_Rect NoClip()
+{
+    SDL_Rect unbounded = { -(1 << 29), -(1 << 29), 1 << 30, 1 << 30 };
+    return unbounded;
+}
+
+// All primitives are clipped to a rectangle, so a tile can be rasterized without touching its neighbours
+SDL_Rect SurfaceBounds(SDL_Surface* surface)
+{
+    SDL_Rect bounds = { 0, 0, surface->w, surface->h };
+    return bounds;
+}
+
+// Primitives are templates over the pixel format, the surface must be in that format
+// Fill pixels <x0, x1) of a row
+template <typename Format>
+void FillSpan(SDL_Surface* surface, const SDL_Rect* clip, int x0, int x1, int y, typename Format::Pixel pixel)
+{
+    if (y < clip->y || y >= clip->y + clip->h)
+    {
+        return;
+    }
+    x0 = SDL_max(x0, clip->x);
+    x1 = SDL_min(x1, clip->x + clip->w);
+
+    typename Format::Pixel* p = (typename Format::Pixel*)((Uint8*)surface->pixels + y * surface->pitch) + x0;
+    for (int x = x0; x < x1; x++)
+    {
+        *p++ = pixel;
+    }
+}
+
+template <typename Format>
+void DrawRectangleClipped(SDL_Surface* screen, const SDL_Rect* clip, int x, int y, int width, int height, Uint32 outlineColor, Uint32 fillColor)
+{
+    int y0 = SDL_max(y, clip->y);
+    int y1 = SDL_min(y + height, clip->y + clip->h);
+    typename Format::Pixel outline = Format::Map(outlineColor);
+    typename Format::Pixel fill = Format::Map(fillColor);
+
+	if (outlineColor != NO_COLOR)   // Outline is optional
+    {
+        for (int i = y0; i < y1; i++)
+        {
+            FillSpan<Format>(screen, clip, x, x + 1, i, outline);
+            FillSpan<Format>(screen, clip, x + width - 1, x + width, i, outline);
+        }
+        FillSpan<Format>(screen, clip, x, x + width, y, outline);
+        FillSpan<Format>(screen, clip, x, x + width, y + height - 1, outline);
+    }
+
+	if (fillColor != NO_COLOR)  // Fill is optional
+    {
+        for (int i = SDL_max(y0, y + 1); i < SDL_min(y1, y + height - 1); i++)
+        {
+            FillSpan<Format>(screen, clip, x + 1, x + width - 1, i, fill);
+        }
+    }
+}
+
+// Widest x with x * x + y * y < radius * radius, -1 if the row is outside the circle
+int CircleHalfWidth(int y, int radius)
+{
+    int half = -1;
+    while ((half + 1) * (half + 1) + y * y < radius * radius)
+    {
+        half++;
+    }
+    return half;
+}
+
+template <typename Format>
+void DrawCircleClipped(SDL_Surface* screen, const SDL_Rect* clip, int cx, int cy, int radius, Uint32 color)
+{
+    int y0 = SDL_max(-radius, clip->y - cy);
+    int y1 = SDL_min(radius, clip->y + clip->h - cy);
+    typename Format::Pixel pixel = Format::Map(color);
+    for (int y = y0; y < y1; y++)
+    {
+        int half = CircleHalfWidth(y, radius);
+        if (half >= 0)
+        {
+            FillSpan<Format>(screen, clip, cx - half, cx + half + 1, cy + y, pixel);
+        }
+    }
+}
+
+// Straight run of segments inside a rectangle of whole cells, its narrow side is one cell. Rows of the narrow
+// body are one span over the whole run, big segments on every other cell widen it back to a full segment.
+template <typename Format>
+void DrawRunClipped(SDL_Surface* screen, const SDL_Rect* clip, const SDL_Rect* run, int phase, int inset, Uint32 color)
+{
+    int size = SDL_min(run->w, run->h);
+    int y0 = SDL_max(run->y + 1, clip->y);
+    int y1 = SDL_min(run->y + run->h - 1, clip->y + clip->h);
+    typename Format::Pixel pixel = Format::Map(color);
+    for (int y = y0; y < y1; y++)
+    {
+        int along = y - run->y;
+        if (run->w > run->h)
+        {
+            if (along > inset && along < size - 1 - inset)
+            {
+                FillSpan<Format>(screen, clip, run->x + 1, run->x + run->w - 1, y, pixel);
+                continue;
+            }
+            for (int x = run->x + phase * size; x < run->x + run->w; x += 2 * size)
+            {
+                FillSpan<Format>(screen, clip, x + 1, x + size - 1, y, pixel);
+            }
+            continue;
+        }
+
+        int within = along % size;
+        int big = (along / size) % 2 == phase && within > 0 && within < size - 1;
+        int pad = big ? 1 : 1 + inset;
+        FillSpan<Format>(screen, clip, run->x + pad, run->x + size - pad, y, pixel);
+    }
+}
+
+// Glyph of the 8x8 charset scaled to a size x size cell
+template <typename Format>
+void DrawGlyphClipped(SDL_Surface* screen, const SDL_Rect* clip, int x, int y, int size, const Font* font, int c, Uint32 color)
+{
+    int y0 = SDL_max(0, clip->y - y);
+    int y1 = SDL_min(size, clip->y + clip->h - y);
+    int x0 = SDL_max(0, clip->x - x);
+    int x1 = SDL_min(size, clip->x + clip->w - x);
+    typename Format::Pixel pixel = Format::Map(color);
+    for (int dy = y0; dy < y1; dy++)
+    {
+        Uint8 row = font->rows[c][dy * 8 / size];
+        if (row == 0)
+        {
+            continue;
+        }
+        typename Format::Pixel* p = (typename Format::Pixel*)((Uint8*)screen->pixels + (y + dy) * screen->pitch) + x;
+        for (int dx = x0; dx < x1; dx++)
+        {
+            if (row & (0x80 >> (dx * 8 / size)))
+            {
+                p[dx] = pixel;
+            }
+        }
+    }
+}
+
+template <typename Format>
+void DrawCommandClipped(SDL_Surface* screen, const SDL_Rect* clip, const DrawCommand* command)
+{
+    const SDL_Rect* b = &command->bounds;
+    SDL_Rect area;  // Caller's clip within the command's own
+    if (SDL_IntersectRect(clip, &command->clip, &area) == SDL_FALSE)
+    {
+        return;
+    }
+    switch (command->type)
+    {
+        case DRAW_RECTANGLE:
+            DrawRectangleClipped<Format>(screen, &area, b->x, b->y, b->w, b->h, command->outlineColor, command->color);
+            break;
+        case DRAW_CIRCLE:
+            DrawCircleClipped<Format>(screen, &area, b->x + b->w / 2, b->y + b->h / 2, b->w / 2, command->color);
+            break;
+        case DRAW_GLYPH:
+            DrawGlyphClipped<Format>(screen, &area, b->x, b->y, b->w, command->font, command->glyph, command->color);
+            break;
+        case DRAW_RUN:
+            DrawRunClipped<Format>(screen, &area, b, command->phase, command->inset, command->color);
+            break;
+    }
+}
+
+// Primitives of one pixel format, picked once per frame so the inner loops never look at the format
+typedef struct
+{
+    void (*rectangle)(SDL_Surface* screen, const SDL_Rect* clip, int x, int y, int width, int height, Uint32 outlineColor, Uint32 fillColor);
+    void (*circle)(SDL_Surface* screen, const SDL_Rect* clip, int cx, int cy, int radius, Uint32 color);
+    void (*glyph)(SDL_Surface* screen, const SDL_Rect* clip, int x, int y, int size, const Font* font, int c, Uint32 color);
+    void (*command)(SDL_Surface* screen, const SDL_Rect* clip, const DrawCommand* command);
+} DrawKernels;
+
+template <typename Format>
+const DrawKernels* KernelsOf()
+{
+    static const DrawKernels kernels = { DrawRectangleClipped<Format>, DrawCircleClipped<Format>, DrawGlyphClipped<Format>, DrawCommandClipped<Format> };
+    return &kernels;
+}
+
+// 8-bit surfaces hold palette indices, 16-bit ones RGB565 and 32-bit ones ARGB8888
+const DrawKernels* SelectKernels(const SDL_Surface* surface)
+{
+    switch (surface->format->BytesPerPixel)
+    {
+        case 1:
+            return KernelsOf<FormatIndexed8>();
+        case 2:
+            return KernelsOf<FormatRGB565>();
+        default:
+            return KernelsOf<FormatARGB8888>();
+    }
+}
+
+// Copy a region between surfaces of the same format, row by row
+void CopyRegion(SDL_Surface* dst, SDL_Surface* src, const SDL_Rect* rect, const SDL_Rect* clip)
+{
+    SDL_Rect clipped;
+    if (SDL_IntersectRect(rect, clip, &clipped) == SDL_FALSE)
+    {
+        return;
+    }
+
+    int bpp = src->format->BytesPerPixel;
+    Uint8* from = (Uint8*)src->pixels + clipped.y * src->pitch + clipped.x * bpp;
+    Uint8* to = (Uint8*)dst->pixels + clipped.y * dst->pitch + clipped.x * bpp;
+    for (int i = 0; i < clipped.h; i++)
+    {
+        memcpy(to, from, clipped.w * bpp);
+        from += src->pitch;
+        to += dst->pitch;
+    }
+}
+
+void DrawRectangle(SDL_Surface* screen, int x, int y, int width, int height, Uint32 outlineColor, Uint32 fillColor)
+{
+    SDL_Rect clip = SurfaceBounds(screen);
+    SelectKernels(screen)->rectangle(screen, &clip, x, y, width, height, outlineColor, fillColor);
+}
+
+void DrawCircle(SDL_Surface* screen, int cx, int cy, int radius, Uint32 color)
+{
+    SDL_Rect clip = SurfaceBounds(screen);
+    SelectKernels(screen)->circle(screen, &clip, cx, cy, radius, color);
+}
+
+void DrawString(SDL_Surface* screen, int x, int y, const char* text, const Font* font, float scale)
+{
+    SDL_Rect clip = SurfaceBounds(screen);
+    const DrawKernels* kernels = SelectKernels(screen);
+    int size = (int)(8 * scale);
+    while (*text)
+    {
+        kernels->glyph(screen, &clip, x, y, size, font, *text & 255, TEXT_COLOR);
+        x += size;
+        text++;
+    }
+}
+
+// Convert the charset bitmap into 1-bit glyph rows, black is transparent
+int LoadFont(const char* file, Font* font)
+{
+    SDL_Surface* charset = SDL_LoadBMP(file);
+    if (charset == NULL)
+    {
+        return 0;
+    }
+
+    SDL_LockSurface(charset);
+    int bpp = charset->format->BytesPerPixel;
+    for (int c = 0; c < 256; c++)
+    {
+        for (int row = 0; row < 8; row++)
+        {
+            Uint8* p = (Uint8*)charset->pixels + ((c / 16) * 8 + row) * charset->pitch + (c % 16) * 8 * bpp;
+            font->rows[c][row] = 0;
+            for (int col = 0; col < 8; col++, p += bpp)
+            {
+                Uint32 pixel = 0;
+                memcpy(&pixel, p, bpp);
+                if ((pixel & ~charset->format->Amask) != 0)
+                {
+                    font->rows[c][row] |= 0x80 >> col;
+                }
+            }
+        }
+    }
+    SDL_UnlockSurface(charset);
+    SDL_FreeSurface(charset);
+    return 1;
+}
+
+// Print the charset bitmap as the initializer of CHARSET, run again whenever cs8x8.bmp changes
+int RunFontTable(const char* file)
+{
+    Font font;
+    if (LoadFont(file, &font) == 0)
+    {
+        printf("SDL_LoadBMP(%s) error: %s\n", file, SDL_GetError());
+        return EXIT_FAILURE;
+    }
+
+    for (int c = 0; c < 256; c++)
+    {
+        printf("    {");
+        for (int row = 0; row < 8; row++)
+        {
+            printf(" 0x%02X%s", font.rows[c][row], row < 7 ? "," : "");
+        }
+        printf(" },");
+        if (c >= ' ' && c < 127 && c != '\\')
+        {
+            printf(" // %c", c);
+        }
+        printf("\n");
+    }
+    return EXIT_SUCCESS;
+}
+
+// Palette indices to 32-bit pixels, one entry per possible index
+void ExpandRow(const Uint8* src, Uint32* dst, int width, const Uint32* palette)
+{
+    for (int x = 0; x < width; x++)
+    {
+        dst[x] = palette[src[x]];
+    }
+}
+
+#ifdef PALETTE_SSSE3
+// 16 pixels per step: pshufb looks every channel up in a 16 entry table, the channels are then interleaved
+TARGET_SSSE3 void ExpandRowSSSE3(const Uint8* src, Uint32* dst, int width, const __m128i* channels, const Uint32* palette)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i index = _mm_loadu_si128((const __m128i*)(src + x));
+        __m128i b = _mm_shuffle_epi8(channels[0], index);
+        __m128i g = _mm_shuffle_epi8(channels[1], index);
+        __m128i r = _mm_shuffle_epi8(channels[2], index);
+        __m128i a = _mm_shuffle_epi8(channels[3], index);
+        __m128i bgLow = _mm_unpacklo_epi8(b, g), bgHigh = _mm_unpackhi_epi8(b, g);
+        __m128i raLow = _mm_unpacklo_epi8(r, a), raHigh = _mm_unpackhi_epi8(r, a);
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_unpacklo_epi16(bgLow, raLow));
+        _mm_storeu_si128((__m128i*)(dst + x + 4), _mm_unpackhi_epi16(bgLow, raLow));
+        _mm_storeu_si128((__m128i*)(dst + x + 8), _mm_unpacklo_epi16(bgHigh, raHigh));
+        _mm_storeu_si128((__m128i*)(dst + x + 12), _mm_unpackhi_epi16(bgHigh, raHigh));
+    }
+    ExpandRow(src + x, dst + x, width - x, palette);
+}
+#endif
+
+// Palette indices to one 8-bit channel, luma planes are looked up like this
+void LookUpRow(const Uint8* src, Uint8* dst, int width, const Uint8* table)
+{
+    for (int x = 0; x < width; x++)
+    {
+        dst[x] = table[src[x]];
+    }
+}
+
+// Channel averaged over the 2x2 blocks of two rows, for chroma subsampled both ways
+void AverageBlocks(const Uint8* top, const Uint8* bottom, Uint8* dst, int width, const Uint8* table)
+{
+    for (int x = 0; x + 1 < width; x += 2)
+    {
+        dst[x / 2] = (Uint8)((table[top[x]] + table[top[x + 1]] + table[bottom[x]] + table[bottom[x + 1]] + 2) >> 2);
+    }
+}
+
+#ifdef PALETTE_SSSE3
+TARGET_SSSE3 void LookUpRowSSSE3(const Uint8* src, Uint8* dst, int width, const __m128i* channel, const Uint8* table)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        _mm_storeu_si128((__m128i*)(dst + x), _mm_shuffle_epi8(*channel, _mm_loadu_si128((const __m128i*)(src + x))));
+    }
+    LookUpRow(src + x, dst + x, width - x, table);
+}
+
+// 16 pixels of both rows per step: pmaddubsw adds horizontal pairs, then the rows are added & rounded
+TARGET_SSSE3 void AverageBlocksSSSE3(const Uint8* top, const Uint8* bottom, Uint8* dst, int width, const __m128i* channel, const Uint8* table)
+{
+    __m128i ones = _mm_set1_epi8(1);
+    __m128i round = _mm_set1_epi16(2);
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i a = _mm_shuffle_epi8(*channel, _mm_loadu_si128((const __m128i*)(top + x)));
+        __m128i b = _mm_shuffle_epi8(*channel, _mm_loadu_si128((const __m128i*)(bottom + x)));
+        __m128i sum = _mm_add_epi16(_mm_maddubs_epi16(a, ones), _mm_maddubs_epi16(b, ones));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, round), 2);
+        _mm_storel_epi64((__m128i*)(dst + x / 2), _mm_packus_epi16(sum, sum));
+    }
+    AverageBlocks(top + x, bottom + x, dst + x / 2, width - x, table);
+}
+#endif
+
+// --- CLASSES ---
+// Converts rows of an indexed back buffer to ARGB8888, e.g. straight into a locked texture
+class PaletteExpander
+{
+private:
+    Uint32 palette[256];
+#ifdef PALETTE_SSSE3
+    __m128i channels[4];    // Byte k of the first 16 palette entries
+#endif
+    int simd;
+
+public:
+    void Initialize()
+    {
+        Uint8 bytes[4][16];
+        for (int i = 0; i < 256; i++)
+        {
+            palette[i] = (i < PALETTE_COLORS ? PALETTE[i] : BACKGROUND_COLOR) | 0xFF000000;
+            for (int k = 0; k < 4 && i < 16; k++)
+            {
+                bytes[k][i] = (Uint8)(palette[i] >> (8 * k));
+            }
+        }
+        simd = 0;
+#ifdef PALETTE_SSSE3
+        for (int k = 0; k < 4; k++)
+        {
+            channels[k] = _mm_loadu_si128((const __m128i*)bytes[k]);
+        }
+        simd = SDL_HasSSE41();  // SDL can't query SSSE3 alone, SSE4.1 implies it
+#endif
+    }
+
+    int UsesSimd() const
+    {
+        return simd;
+    }
+
+    // Rows <y, y + count) of the source go to consecutive rows of the destination
+    void Expand(const SDL_Surface* src, int y, int count, void* pixels, int pitch)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            const Uint8* from = (const Uint8*)src->pixels + (y + i) * src->pitch;
+            Uint32* to = (Uint32*)((Uint8*)pixels + i * pitch);
+#ifdef PALETTE_SSSE3
+            if (simd)
+            {
+                ExpandRowSSSE3(from, to, src->w, channels, palette);
+                continue;
+            }
+#endif
+            ExpandRow(from, to, src->w, palette);
+        }
+    }
+};
+
+// Converts indexed screens to video frames, YUV 4:2:0 planes (BT.601, limited range) or packed RGB24.
+// Palette colors are converted once, every pixel is a table lookup.
+class FrameEncoder
+{
+private:
+    Uint8 tables[3][16];    // Y, U & V of the first 16 palette entries
+#ifdef PALETTE_SSSE3
+    __m128i channels[3];
+#endif
+    int simd;
+
+    void LookUp(const Uint8* src, Uint8* dst, int width, int plane)
+    {
+#ifdef PALETTE_SSSE3
+        if (simd)
+        {
+            LookUpRowSSSE3(src, dst, width, &channels[plane], tables[plane]);
+            return;
+        }
+#endif
+        LookUpRow(src, dst, width, tables[plane]);
+    }
+
+    void Average(const Uint8* top, const Uint8* bottom, Uint8* dst, int width, int plane)
+    {
+#ifdef PALETTE_SSSE3
+        if (simd)
+        {
+            AverageBlocksSSSE3(top, bottom, dst, width, &channels[plane], tables[plane]);
+            return;
+        }
+#endif
+        AverageBlocks(top, bottom, dst, width, tables[plane]);
+    }
+
+    void EncodeYuv(const Uint8* src, int width, int height, Uint8* frame)
+    {
+        Uint8* u = frame + width * height;
+        Uint8* v = u + (width / 2) * (height / 2);
+        for (int y = 0; y < height; y++)
+        {
+            LookUp(src + y * width, frame + y * width, width, 0);
+        }
+        for (int y = 0; y + 1 < height; y += 2)
+        {
+            Average(src + y * width, src + (y + 1) * width, u + (y / 2) * (width / 2), width, 1);
+            Average(src + y * width, src + (y + 1) * width, v + (y / 2) * (width / 2), width, 2);
+        }
+    }
+
+    void EncodeRgb(const Uint8* src, int width, int height, Uint8* frame)
+    {
+        for (int i = 0; i < width * height; i++)
+        {
+            Uint32 color = PALETTE[src[i] < PALETTE_COLORS ? src[i] : 0];
+            frame[3 * i] = (Uint8)(color >> 16);
+            frame[3 * i + 1] = (Uint8)(color >> 8);
+            frame[3 * i + 2] = (Uint8)color;
+        }
+    }
+
+public:
+    void Initialize()
+    {
+        for (int i = 0; i < 16; i++)
+        {
+            Uint32 color = i < PALETTE_COLORS ? PALETTE[i] : BACKGROUND_COLOR;
+            int r = (color >> 16) & 0xFF, g = (color >> 8) & 0xFF, b = color & 0xFF;
+            tables[0][i] = (Uint8)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            tables[1][i] = (Uint8)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            tables[2][i] = (Uint8)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+        simd = 0;
+#ifdef PALETTE_SSSE3
+        for (int k = 0; k < 3; k++)
+        {
+            channels[k] = _mm_loadu_si128((const __m128i*)tables[k]);
+        }
+        simd = SDL_HasSSE41();  // SDL can't query SSSE3 alone, SSE4.1 implies it
+#endif
+    }
+
+    int UsesSimd() const
+    {
+        return simd;
+    }
+
+    // Bytes of an encoded frame, width & height are even
+    static int FrameSize(CaptureFormat format, int width, int height)
+    {
+        return format == CAPTURE_Y4M ? width * height * 3 / 2 : width * height * 3;
+    }
+
+    // Tightly packed palette indices to a frame of the format
+    void Encode(CaptureFormat format, const Uint8* src, int width, int height, Uint8* frame)
+    {
+        if (format == CAPTURE_Y4M)
+        {
+            EncodeYuv(src, width, height, frame);
+        }
+        else
+        {
+            EncodeRgb(src, width, height, frame);
+        }
+    }
+};
+
+// Frames go from the renderer to a writer thread through a ring of recycled buffers. The renderer only
+// copies its indexed screen, encoding & writing to the file or pipe happen on the writer thread.
+class CaptureWriter
+{
+private:
+    FILE* file;
+    CaptureFormat format;
+    int width;
+    int height;
+    Uint8* buffers[CAPTURE_BUFFERS];    // Indexed screens, filled & written in ring order
+    Uint8* frame;       // Encoded on the writer thread
+    SDL_sem* vacant;    // Buffers the renderer may fill
+    SDL_sem* queued;    // Buffers waiting for the writer, plus one post when closing
+    SDL_atomic_t submitted;
+    int filled;     // Renderer only
+    int written;    // Writer thread only
+    int failed;     // Set by the writer thread on a write error
+    int stalls;     // Frames the renderer had to wait for a buffer
+    SDL_Thread* thread;
+    FrameEncoder encoder;
+
+    static int SDLCALL WriterMain(void* data)
+    {
+        CaptureWriter* writer = (CaptureWriter*)data;
+        while (1)
+        {
+            SDL_SemWait(writer->queued);
+            if (writer->written == SDL_AtomicGet(&writer->submitted))
+            {
+                return 0;   // Closing, every frame has been written
+            }
+            writer->WriteFrame(writer->buffers[writer->written % CAPTURE_BUFFERS]);
+            writer->written++;
+            SDL_SemPost(writer->vacant);
+        }
+    }
+
+    void WriteFrame(const Uint8* screen)
+    {
+        int size = FrameEncoder::FrameSize(format, width, height);
+        encoder.Encode(format, screen, width, height, frame);
+        if ((format == CAPTURE_Y4M && fputs("FRAME\n", file) < 0) || fwrite(frame, 1, size, file) != (size_t)size)
+        {
+            failed = 1;
+        }
+    }
+
+public:
+    CaptureWriter()
+    {
+        file = NULL;
+        frame = NULL;
+        vacant = queued = NULL;
+        thread = NULL;
+        filled = 0;
+        memset(buffers, 0, sizeof(buffers));
+    }
+
+    ~CaptureWriter()
+    {
+        Close();
+    }
+
+    // Paths ending in .rgb get raw RGB24 frames, anything else Y4M, which players & encoders read from pipes too
+    int Open(const char* path, int frameWidth, int frameHeight, int fps)
+    {
+        format = EndsWith(path, ".rgb") ? CAPTURE_RGB : CAPTURE_Y4M;
+        width = frameWidth;
+        height = frameHeight;
+        file = fopen(path, "wb");
+        if (file == NULL)
+        {
+            printf("Can't open %s for writing\n", path);
+            return 0;
+        }
+        if (format == CAPTURE_Y4M)
+        {
+            fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+        }
+
+        for (int i = 0; i < CAPTURE_BUFFERS; i++)
+        {
+            buffers[i] = (Uint8*)malloc(width * height);
+        }
+        frame = (Uint8*)malloc(FrameEncoder::FrameSize(format, width, height));
+        encoder.Initialize();
+        vacant = SDL_CreateSemaphore(CAPTURE_BUFFERS);
+        queued = SDL_CreateSemaphore(0);
+        SDL_AtomicSet(&submitted, 0);
+        written = failed = stalls = 0;
+        thread = vacant != NULL && queued != NULL ? SDL_CreateThread(WriterMain, "Capture", this) : NULL;
+        if (thread == NULL)
+        {
+            printf("SDL_CreateThread error: %s\n", SDL_GetError());
+            return 0;
+        }
+        return 1;
+    }
+
+    // Buffer for the next frame, the renderer only waits when the writer is a whole ring of frames behind
+    Uint8* Acquire()
+    {
+        if (SDL_SemTryWait(vacant) != 0)
+        {
+            stalls++;
+            SDL_SemWait(vacant);
+        }
+        return buffers[filled % CAPTURE_BUFFERS];
+    }
+
+    // The acquired buffer goes to the writer
+    void Submit()
+    {
+        SDL_AtomicSet(&submitted, ++filled);
+        SDL_SemPost(queued);
+    }
+
+    // Frames in flight are written before the file is closed
+    void Close()
+    {
+        if (thread != NULL)
+        {
+            SDL_SemPost(queued);
+            SDL_WaitThread(thread, NULL);
+            thread = NULL;
+            printf("Captured %d frames (%s encoding)%s, waited for the writer %d times\n", filled,
+                encoder.UsesSimd() ? "SSSE3" : "scalar", failed ? ", WRITE ERRORS" : "", stalls);
+        }
+        if (file != NULL)
+        {
+            fclose(file);
+            file = NULL;
+        }
+        SDL_DestroySemaphore(vacant);
+        SDL_DestroySemaphore(queued);
+        vacant = queued = NULL;
+        for (int i = 0; i < CAPTURE_BUFFERS; i++)
+        {
+            free(buffers[i]);
+            buffers[i] = NULL;
+        }
+        free(frame);
+        frame = NULL;
+    }
+};
+
+// Events of one thread on their way to the telemetry file. One thread emits, the flusher drains, neither ever waits:
+// a full ring drops the event and counts it.
+class EventRing
+{
+private:
+    EventRecord records[TELEMETRY_RING_SIZE];
+    SDL_atomic_t written;   // Published by the emitting thread
+    SDL_atomic_t drained;   // Released by the flusher
+    Uint32 head;    // Emitting thread only
+    Uint32 limit;   // Emitting thread only, the head can reach it without looking at what was drained
+    Uint32 tail;    // Flusher only
+    Uint16 id;
+
+public:
+    Uint32 dropped; // Emitting thread only, read once it has stopped
+
+    EventRing(Uint16 ring)
+    {
+        SDL_AtomicSet(&written, 0);
+        SDL_AtomicSet(&drained, 0);
+        head = 0;
+        limit = TELEMETRY_RING_SIZE;
+        tail = 0;
+        id = ring;
+        dropped = 0;
+    }
+
+    // A store into the ring & a release, the drained count is only read when the ring looks full
+    void Emit(EventType type, int tick, Uint32 time, Sint32 value)
+    {
+        if (head == limit)
+        {
+            limit = (Uint32)SDL_AtomicGet(&drained) + TELEMETRY_RING_SIZE;
+            if (head == limit)
+            {
+                dropped++;
+                return;
+            }
+        }
+        EventRecord* record = &records[head % TELEMETRY_RING_SIZE];
+        record->tick = (Uint32)tick;
+        record->time = time;
+        record->type = (Uint16)type;
+        record->ring = id;
+        record->value = value;
+        head++;
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&written, (int)head);
+    }
+
+    // Flusher: everything published so far goes to the file in at most two writes, returns the number of events
+    Uint32 Drain(FILE* file, int* failed)
+    {
+        Uint32 end = (Uint32)SDL_AtomicGet(&written);
+        SDL_MemoryBarrierAcquire();
+        Uint32 count = end - tail;
+        while (tail != end)
+        {
+            Uint32 at = tail % TELEMETRY_RING_SIZE;
+            Uint32 run = SDL_min(end - tail, TELEMETRY_RING_SIZE - at);
+            *failed |= fwrite(&records[at], sizeof(EventRecord), run, file) != run;
+            tail += run;
+        }
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&drained, (int)tail);
+        return count;
+    }
+};
+
+// Structured event stream. Every emitting thread gets a ring of its own, a background thread drains them all in
+// batches, so emitting never allocates, locks or touches the file.
+class Telemetry
+{
+private:
+    FILE* file;
+    EventRing* rings[TELEMETRY_RINGS];
+    SDL_atomic_t ringCount;     // Slots claimed, may pass TELEMETRY_RINGS
+    SDL_sem* stop;
+    SDL_Thread* thread;
+    Uint64 events;  // Flusher only
+    int failed;     // Flusher only
+
+    // NULL for a slot not claimed yet, or claimed by a thread that is still building its ring
+    EventRing* GetRing(int slot)
+    {
+        EventRing* ring = (EventRing*)SDL_AtomicGetPtr((void**)&rings[slot]);
+        SDL_MemoryBarrierAcquire();
+        return ring;
+    }
+
+    static int SDLCALL FlusherMain(void* data)
+    {
+        Telemetry* telemetry = (Telemetry*)data;
+        int stopping = 0;
+        while (stopping == 0)
+        {
+            stopping = SDL_SemWaitTimeout(telemetry->stop, TELEMETRY_FLUSH_INTERVAL) == 0;
+            int count = SDL_min(SDL_AtomicGet(&telemetry->ringCount), TELEMETRY_RINGS);
+            for (int i = 0; i < count; i++)
+            {
+                EventRing* ring = telemetry->GetRing(i);
+                telemetry->events += ring != NULL ? ring->Drain(telemetry->file, &telemetry->failed) : 0;
+            }
+            telemetry->failed |= fflush(telemetry->file) != 0;
+        }
+        return 0;
+    }
+
+public:
+    Telemetry()
+    {
+        file = NULL;
+        memset(rings, 0, sizeof(rings));
+        SDL_AtomicSet(&ringCount, 0);
+        stop = NULL;
+        thread = NULL;
+    }
+
+    ~Telemetry()
+    {
+        Close();
+        for (int i = 0; i < TELEMETRY_RINGS; i++)
+        {
+            delete rings[i];
+        }
+    }
+
+    // Events are appended, a new file starts with the header
+    int Open(const char* path)
+    {
+        TelemetryHeader header = { { 0 }, TELEMETRY_VERSION, sizeof(EventRecord), 0 };
+        memcpy(header.magic, TELEMETRY_MAGIC, 4);
+        Uint64 size = FileSize(path);
+        file = fopen(path, "ab");
+        if (file == NULL || (size == 0 && fwrite(&header, sizeof(header), 1, file) != 1))
+        {
+            printf("Can't write to telemetry file %s\n", path);
+            return 0;
+        }
+        events = 0;
+        failed = 0;
+        stop = SDL_CreateSemaphore(0);
+        thread = stop != NULL ? SDL_CreateThread(FlusherMain, "Telemetry", this) : NULL;
+        if (thread == NULL)
+        {
+            printf("SDL_CreateThread error: %s\n", SDL_GetError());
+            return 0;
+        }
+        return 1;
+    }
+
+    // Ring of the calling thread, taken once before it starts emitting. Threads may register at the same time, each
+    // claims a slot of its own. NULL once every ring is given out.
+    EventRing* AddRing()
+    {
+        int slot = SDL_AtomicAdd(&ringCount, 1);
+        if (slot >= TELEMETRY_RINGS)
+        {
+            return NULL;
+        }
+        EventRing* ring = new EventRing((Uint16)slot);
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSetPtr((void**)&rings[slot], ring);
+        return ring;
+    }
+
+    // Events emitted before are written, the rings stay until the telemetry is destroyed
+    void Close()
+    {
+        if (thread != NULL)
+        {
+            SDL_SemPost(stop);
+            SDL_WaitThread(thread, NULL);
+            thread = NULL;
+            Uint32 dropped = 0;
+            for (int i = 0; i < TELEMETRY_RINGS; i++)
+            {
+                dropped += rings[i] != NULL ? rings[i]->dropped : 0;
+            }
+            printf("Telemetry: %llu events, %u dropped%s\n", (unsigned long long)events, dropped, failed ? ", WRITE ERRORS" : "");
+        }
+        if (file != NULL)
+        {
+            fclose(file);
+            file = NULL;
+        }
+        SDL_DestroySemaphore(stop);
+        stop = NULL;
+    }
+};
+
+// Paces frames with vsync or by sleeping until the next deadline, and measures idle time
+class FrameScheduler
+{
+private:
+    Uint64 frequency;   // Performance counter ticks per second
+    Uint64 frameTicks;  // Minimum frame duration, 0 = unlimited
+    Uint64 refreshTicks;    // Display refresh duration, 0 = no vsync
+    Uint64 nextFrame;
+    Uint64 lastFrame;
+    Uint64 startCounter;
+    Uint64 idleTicks;
+    int frames;
+
+    // SDL_Delay is coarse, so sleep until shortly before the deadline and spin for the rest
+    void SleepUntil(Uint64 deadline)
+    {
+        Uint64 now = SDL_GetPerformanceCounter();
+        Uint64 margin = frequency * SPIN_MARGIN / 1000;
+        if (now + margin < deadline)
+        {
+            SDL_Delay((Uint32)((deadline - now - margin) * 1000 / frequency));
+            idleTicks += SDL_GetPerformanceCounter() - now;
+        }
+
+        while (SDL_GetPerformanceCounter() < deadline)
+        {
+        }
+    }
+
+public:
+    void Initialize(int targetFps, int refreshRate)
+    {
+        frequency = SDL_GetPerformanceFrequency();
+        frameTicks = targetFps > 0 ? frequency / targetFps : 0;
+        refreshTicks = refreshRate > 0 ? frequency / refreshRate : 0;
+        startCounter = SDL_GetPerformanceCounter();
+        nextFrame = startCounter;
+        lastFrame = startCounter;
+        idleTicks = 0;
+        frames = 0;
+    }
+
+    // Time blocked on vsync inside the present counts as idle
+    void Present(SDL_Renderer* renderer)
+    {
+        Uint64 start = SDL_GetPerformanceCounter();
+        SDL_RenderPresent(renderer);
+        if (refreshTicks > 0)
+        {
+            idleTicks += SDL_GetPerformanceCounter() - start;
+        }
+    }
+
+    // Sleep until the next display deadline or simulation tick, whichever comes first
+    void Wait(Sint32 untilNextTick)
+    {
+        Uint64 now = SDL_GetPerformanceCounter();
+        Uint64 frameTime = now - lastFrame;
+        lastFrame = now;
+        frames++;
+
+        if (refreshTicks > 0 && frameTime >= refreshTicks / 2 && frameTicks <= refreshTicks)
+        {
+            return; // Present already waited for vsync
+        }
+        if (frameTicks == 0 || untilNextTick < 0)
+        {
+            return;
+        }
+
+        if (now >= nextFrame)
+        {
+            nextFrame = (now - nextFrame < frameTicks) ? nextFrame + frameTicks : now + frameTicks;
+        }
+        Uint64 deadline = nextFrame;
+        Uint64 tickDeadline = now + (Uint64)untilNextTick * frequency / 1000;
+        if (tickDeadline < deadline)
+        {
+            deadline = tickDeadline;
+        }
+        SleepUntil(deadline);
+    }
+
+    // Time blocked waiting for input counts as idle
+    void WaitEvent(SDL_Event* event)
+    {
+        Uint64 start = SDL_GetPerformanceCounter();
+        SDL_WaitEvent(event);
+        idleTicks += SDL_GetPerformanceCounter() - start;
+    }
+
+    void Report()
+    {
+        double seconds = (double)(SDL_GetPerformanceCounter() - startCounter) / frequency;
+        if (seconds > 0)
+        {
+            printf("Frames: %d, average FPS: %.1f, idle: %.1f%%\n", frames, frames / seconds, 100.0 * idleTicks / frequency / seconds);
+        }
+    }
+};
+
+// Commands of one frame, plus regions to restore from the background layer before drawing them
+class DrawList
+{
+private:
+    DrawCommand* commands;
+    int count;
+    int capacity;
+    SDL_Rect* restore;
+    int restoreCount;
+    int restoreCapacity;
+    SDL_Rect clip;  // Given to commands added from now on
+
+    DrawCommand* Append(DrawCommandType type, int x, int y, int width, int height, Uint32 color)
+    {
+        if (count == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 64;
+            commands = (DrawCommand*)realloc(commands, capacity * sizeof(DrawCommand));
+        }
+        DrawCommand* command = &commands[count++];
+        command->type = type;
+        command->bounds.x = x;
+        command->bounds.y = y;
+        command->bounds.w = width;
+        command->bounds.h = height;
+        command->outlineColor = NO_COLOR;
+        command->color = color;
+        command->clip = clip;
+        return command;
+    }
+
+public:
+    DrawList()
+    {
+        commands = NULL;
+        restore = NULL;
+        count = capacity = 0;
+        restoreCount = restoreCapacity = 0;
+        SetClip(NULL);
+    }
+
+    ~DrawList()
+    {
+        free(commands);
+        free(restore);
+    }
+
+    void Clear()
+    {
+        count = 0;
+        restoreCount = 0;
+        SetClip(NULL);
+    }
+
+    // NULL = no clipping
+    void SetClip(const SDL_Rect* rect)
+    {
+        clip = rect != NULL ? *rect : NoClip();
+    }
+
+    void AddRestore(const SDL_Rect* rect)
+    {
+        if (restoreCount == restoreCapacity)
+        {
+            restoreCapacity = restoreCapacity > 0 ? restoreCapacity * 2 : 64;
+            restore = (SDL_Rect*)realloc(restore, restoreCapacity * sizeof(SDL_Rect));
+        }
+        restore[restoreCount++] = *rect;
+    }
+
+    void AddRectangle(int x, int y, int width, int height, Uint32 outlineColor, Uint32 fillColor)
+    {
+        Append(DRAW_RECTANGLE, x, y, width, height, fillColor)->outlineColor = outlineColor;
+    }
+
+    void AddCircle(int cx, int cy, int radius, Uint32 color)
+    {
+        Append(DRAW_CIRCLE, cx - radius, cy - radius, radius * 2, radius * 2, color);
+    }
+
+    void AddGlyph(int x, int y, int c, const Font* font, float scale)
+    {
+        DrawCommand* command = Append(DRAW_GLYPH, x, y, (int)(8 * scale), (int)(8 * scale), TEXT_COLOR);
+        command->font = font;
+        command->glyph = c & 255;
+    }
+
+    void AddRun(int x, int y, int width, int height, int phase, int inset, Uint32 color)
+    {
+        DrawCommand* command = Append(DRAW_RUN, x, y, width, height, color);
+        command->phase = phase;
+        command->inset = inset;
+    }
+
+    void AddText(int x, int y, const char* text, const Font* font, float scale)
+    {
+        for (; *text; text++, x += (int)(8 * scale))
+        {
+            AddGlyph(x, y, *text, font, scale);
+        }
+    }
+
+    int GetCount() const { return count; }
+    const DrawCommand* GetCommand(int i) const { return &commands[i]; }
+    int GetRestoreCount() const { return restoreCount; }
+    const SDL_Rect* GetRestore(int i) const { return &restore[i]; }
+};
+
+// Solid rectangles grouped by color, each group is submitted with one SDL_RenderFillRects call.
+// Groups are drawn in order of first use, so rectangles of different colors should not overlap.
+class RectBatch
+{
+private:
+    Uint32 colors[RECT_BATCH_COLORS];
+    SDL_Rect* rects[RECT_BATCH_COLORS];
+    int counts[RECT_BATCH_COLORS];
+    int capacities[RECT_BATCH_COLORS];
+    int colorCount;
+    int total;
+    SDL_Rect clip;
+
+    void Add(int x, int y, int width, int height, Uint32 color)
+    {
+        SDL_Rect given = { x, y, width, height }, rect;
+        if (SDL_IntersectRect(&given, &clip, &rect) == SDL_FALSE)
+        {
+            return;
+        }
+        int group = 0;
+        while (group < colorCount && colors[group] != color)
+        {
+            group++;
+        }
+        if (group == RECT_BATCH_COLORS)
+        {
+            return;
+        }
+        if (group == colorCount)
+        {
+            colors[colorCount++] = color;
+        }
+        if (counts[group] == capacities[group])
+        {
+            capacities[group] = capacities[group] > 0 ? capacities[group] * 2 : 64;
+            rects[group] = (SDL_Rect*)realloc(rects[group], capacities[group] * sizeof(SDL_Rect));
+        }
+        rects[group][counts[group]++] = rect;
+        total++;
+    }
+
+public:
+    RectBatch()
+    {
+        for (int i = 0; i < RECT_BATCH_COLORS; i++)
+        {
+            rects[i] = NULL;
+            capacities[i] = 0;
+        }
+        Clear();
+    }
+
+    ~RectBatch()
+    {
+        for (int i = 0; i < RECT_BATCH_COLORS; i++)
+        {
+            free(rects[i]);
+        }
+    }
+
+    void Clear()
+    {
+        for (int i = 0; i < RECT_BATCH_COLORS; i++)
+        {
+            counts[i] = 0;
+        }
+        colorCount = 0;
+        total = 0;
+        SetClip(NULL);
+    }
+
+    // Rectangles added from now on are cut to the clip, NULL = no clipping
+    void SetClip(const SDL_Rect* rect)
+    {
+        clip = rect != NULL ? *rect : NoClip();
+    }
+
+    // Same pixels as DrawRectangle: a 1 pixel outline around an inner fill
+    void AddRectangle(int x, int y, int width, int height, Uint32 outlineColor, Uint32 fillColor)
+    {
+        if (outlineColor != NO_COLOR)
+        {
+            Add(x, y, width, 1, outlineColor);
+            Add(x, y + height - 1, width, 1, outlineColor);
+            Add(x, y + 1, 1, height - 2, outlineColor);
+            Add(x + width - 1, y + 1, 1, height - 2, outlineColor);
+        }
+        if (fillColor != NO_COLOR)
+        {
+            Add(x + 1, y + 1, width - 2, height - 2, fillColor);
+        }
+    }
+
+    // Same pixels as DrawCircle, one rectangle per row
+    void AddCircle(int cx, int cy, int radius, Uint32 color)
+    {
+        for (int y = -radius; y < radius; y++)
+        {
+            int half = CircleHalfWidth(y, radius);
+            Add(cx - half, cy + y, 2 * half + 1, 1, color);
+        }
+    }
+
+    void Submit(SDL_Renderer* renderer)
+    {
+        for (int i = 0; i < colorCount; i++)
+        {
+            SDL_SetRenderDrawColor(renderer, (colors[i] >> 16) & 0xFF, (colors[i] >> 8) & 0xFF, colors[i] & 0xFF, 255);
+            SDL_RenderFillRects(renderer, rects[i], counts[i]);
+        }
+    }
+
+    int GetCount() const
+    {
+        return total;
+    }
+
+    int GetColorCount() const
+    {
+        return colorCount;
+    }
+};
+
+// Static part of the scene, rendered once and copied back over regions drawn in the previous frame
+class BackgroundLayer
+{
+private:
+    SDL_Surface* surface;
+    SDL_Rect dirty[MAX_DIRTY_RECTS];
+    int dirtyCount;
+
+public:
+    BackgroundLayer()
+    {
+        surface = NULL;
+        dirtyCount = 0;
+    }
+
+    ~BackgroundLayer()
+    {
+        SDL_FreeSurface(surface);
+    }
+
+    // Same format as the screen it is restored to
+    int Initialize(int indexed)
+    {
+        surface = indexed ? CreateIndexedSurface(WINDOW_WIDTH, WINDOW_HEIGHT) : CreateSurface(WINDOW_WIDTH, WINDOW_HEIGHT);
+        return surface != NULL;
+    }
+
+    SDL_Surface* GetSurface()
+    {
+        return surface;
+    }
+
+    // Remember a region drawn over the layer, so that it is restored in the next frame
+    void MarkDirty(int x, int y, int width, int height)
+    {
+        if (dirtyCount < MAX_DIRTY_RECTS)
+        {
+            SDL_Rect rect = { x, y, width, height };
+            dirty[dirtyCount++] = rect;
+        }
+    }
+
+    // Hand last frame's regions over to be restored before this frame is drawn
+    void TakeDirty(DrawList* list)
+    {
+        for (int i = 0; i < dirtyCount; i++)
+        {
+            list->AddRestore(&dirty[i]);
+        }
+        dirtyCount = 0;
+    }
+};
+
+// Rasterizes draw lists directly, or binned into tiles rasterized on a pool of threads.
+// A tile restores its part of the regions and then draws its commands in order, so the output
+// is the same as drawing the whole list directly.
+class Rasterizer
+{
+private:
+    int threadCount;
+    int tiled;
+    SDL_Thread** threads;
+    SDL_sem* start;
+    SDL_sem* done;
+    SDL_atomic_t nextTile;
+    int stopping;
+
+    SDL_Surface* target;
+    SDL_Surface* background;
+    const DrawList* list;
+    const DrawKernels* kernels; // Of the target's format
+    int tilesX;
+    int tilesY;
+    int* binStart;      // Per tile offsets into binItems
+    int* binFill;
+    int* binItems;      // Restored regions as -1 - index, followed by command indices
+    int itemCapacity;
+    int* activeTiles;
+    int activeCount;
+
+    static int Worker(void* data)
+    {
+        Rasterizer* rasterizer = (Rasterizer*)data;
+        while (1)
+        {
+            SDL_SemWait(rasterizer->start);
+            if (rasterizer->stopping)
+            {
+                return 0;
+            }
+            rasterizer->RunTiles();
+            SDL_SemPost(rasterizer->done);
+        }
+    }
+
+    void RunTiles()
+    {
+        int i;
+        while ((i = SDL_AtomicAdd(&nextTile, 1)) < activeCount)
+        {
+            RasterizeTile(activeTiles[i]);
+        }
+    }
+
+    void RasterizeTile(int tile)
+    {
+        SDL_Rect clip = { (tile % tilesX) * RASTER_TILE_WIDTH, (tile / tilesX) * RASTER_TILE_HEIGHT, RASTER_TILE_WIDTH, RASTER_TILE_HEIGHT };
+        clip.w = SDL_min(clip.w, target->w - clip.x);
+        clip.h = SDL_min(clip.h, target->h - clip.y);
+        for (int i = binStart[tile]; i < binStart[tile + 1]; i++)
+        {
+            int item = binItems[i];
+            if (item < 0)
+            {
+                CopyRegion(target, background, list->GetRestore(-1 - item), &clip);
+            }
+            else
+            {
+                kernels->command(target, &clip, list->GetCommand(item));
+            }
+        }
+    }
+
+    // Range of tiles covered by a rectangle, returns 0 if it lies outside the target
+    int TileRange(const SDL_Rect* rect, int* x0, int* y0, int* x1, int* y1)
+    {
+        SDL_Rect bounds = SurfaceBounds(target);
+        SDL_Rect clipped;
+        if (SDL_IntersectRect(rect, &bounds, &clipped) == SDL_FALSE)
+        {
+            return 0;
+        }
+        *x0 = clipped.x / RASTER_TILE_WIDTH;
+        *y0 = clipped.y / RASTER_TILE_HEIGHT;
+        *x1 = (clipped.x + clipped.w - 1) / RASTER_TILE_WIDTH;
+        *y1 = (clipped.y + clipped.h - 1) / RASTER_TILE_HEIGHT;
+        return 1;
+    }
+
+    // Count items per tile (fill == 0) or write them into their bins (fill == 1)
+    void BinItem(const SDL_Rect* rect, int item, int fill)
+    {
+        int x0, y0, x1, y1;
+        if (TileRange(rect, &x0, &y0, &x1, &y1) == 0)
+        {
+            return;
+        }
+        for (int ty = y0; ty <= y1; ty++)
+        {
+            for (int tx = x0; tx <= x1; tx++)
+            {
+                int tile = ty * tilesX + tx;
+                if (fill)
+                {
+                    binItems[binFill[tile]++] = item;
+                }
+                else
+                {
+                    binStart[tile + 1]++;
+                }
+            }
+        }
+    }
+
+    void BinAll(int fill)
+    {
+        for (int i = 0; i < list->GetRestoreCount(); i++)
+        {
+            BinItem(list->GetRestore(i), -1 - i, fill);
+        }
+        for (int i = 0; i < list->GetCount(); i++)
+        {
+            BinItem(&list->GetCommand(i)->bounds, i, fill);
+        }
+    }
+
+    void ResizeBins()
+    {
+        int tiles = tilesX * tilesY;
+        tilesX = (target->w + RASTER_TILE_WIDTH - 1) / RASTER_TILE_WIDTH;
+        tilesY = (target->h + RASTER_TILE_HEIGHT - 1) / RASTER_TILE_HEIGHT;
+        if (tilesX * tilesY != tiles)
+        {
+            binStart = (int*)realloc(binStart, (tilesX * tilesY + 1) * sizeof(int));
+            binFill = (int*)realloc(binFill, tilesX * tilesY * sizeof(int));
+            activeTiles = (int*)realloc(activeTiles, tilesX * tilesY * sizeof(int));
+        }
+    }
+
+    void Bin()
+    {
+        ResizeBins();
+        int tiles = tilesX * tilesY;
+        memset(binStart, 0, (tiles + 1) * sizeof(int));
+        BinAll(0);
+
+        activeCount = 0;
+        for (int tile = 0; tile < tiles; tile++)
+        {
+            if (binStart[tile + 1] > 0)
+            {
+                activeTiles[activeCount++] = tile;
+            }
+            binStart[tile + 1] += binStart[tile];
+            binFill[tile] = binStart[tile];
+        }
+
+        if (binStart[tiles] > itemCapacity)
+        {
+            itemCapacity = binStart[tiles] * 2;
+            binItems = (int*)realloc(binItems, itemCapacity * sizeof(int));
+        }
+        BinAll(1);
+    }
+
+    void ExecuteDirect()
+    {
+        SDL_Rect clip = SurfaceBounds(target);
+        for (int i = 0; i < list->GetRestoreCount(); i++)
+        {
+            CopyRegion(target, background, list->GetRestore(i), &clip);
+        }
+        for (int i = 0; i < list->GetCount(); i++)
+        {
+            kernels->command(target, &clip, list->GetCommand(i));
+        }
+    }
+
+public:
+    Rasterizer()
+    {
+        threadCount = 1;
+        tiled = 0;
+        threads = NULL;
+        start = done = NULL;
+        stopping = 0;
+        tilesX = tilesY = 0;
+        binStart = binFill = binItems = activeTiles = NULL;
+        itemCapacity = 0;
+        kernels = NULL;
+    }
+
+    ~Rasterizer()
+    {
+        stopping = 1;
+        for (int i = 0; i < threadCount - 1 && threads != NULL; i++)
+        {
+            SDL_SemPost(start);
+        }
+        for (int i = 0; i < threadCount - 1 && threads != NULL; i++)
+        {
+            SDL_WaitThread(threads[i], NULL);
+        }
+        free(threads);
+        SDL_DestroySemaphore(start);
+        SDL_DestroySemaphore(done);
+        free(binStart);
+        free(binFill);
+        free(binItems);
+        free(activeTiles);
+    }
+
+    // The main thread rasterizes tiles too, so threadCount - 1 workers are started
+    int Initialize(int threadCount, int tiled)
+    {
+        this->threadCount = threadCount > 1 ? threadCount : 1;
+        this->tiled = tiled;
+        start = SDL_CreateSemaphore(0);
+        done = SDL_CreateSemaphore(0);
+        threads = (SDL_Thread**)calloc(this->threadCount, sizeof(SDL_Thread*));
+        for (int i = 0; i < this->threadCount - 1; i++)
+        {
+            threads[i] = SDL_CreateThread(Worker, "rasterizer", this);
+            if (threads[i] == NULL)
+            {
+                this->threadCount = i + 1;
+                return 0;
+            }
+        }
+        return start != NULL && done != NULL;
+    }
+
+    void Execute(SDL_Surface* screen, SDL_Surface* layer, const DrawList* drawList)
+    {
+        target = screen;
+        background = layer;
+        list = drawList;
+        kernels = SelectKernels(screen);
+        if (!tiled)
+        {
+            ExecuteDirect();
+            return;
+        }
+
+        Bin();
+        SDL_AtomicSet(&nextTile, 0);
+        for (int i = 0; i < threadCount - 1; i++)
+        {
+            SDL_SemPost(start);
+        }
+        RunTiles();
+        for (int i = 0; i < threadCount - 1; i++)
+        {
+            SDL_SemWait(done);
+        }
+    }
+};
+
+// Board drawn as one texel per cell into a small streaming texture, which SDL stretches over the board.
+// Only texels of cells that changed since the previous frame are uploaded.
+class CellGrid
+{
+private:
+    SDL_Texture* texture;
+    Uint32* texels;     // Copy of the texture contents
+    Uint32* pending;    // Contents of the frame being drawn
+    int* touched;       // Cells set in this frame, followed by cells set in the previous one
+    int touchedCount;
+    int previousCount;
+    int* changed;
+    int changedCount;
+    int columns;
+    int rows;
+
+    void UploadChanged()
+    {
+        if (changedCount <= GRID_MAX_TEXEL_UPDATES)
+        {
+            for (int i = 0; i < changedCount; i++)
+            {
+                SDL_Rect texel = { changed[i] % columns, changed[i] / columns, 1, 1 };
+                SDL_UpdateTexture(texture, &texel, &texels[changed[i]], columns * sizeof(Uint32));
+            }
+            return;
+        }
+
+        SDL_Rect box = { columns, rows, 0, 0 };
+        int x1 = 0, y1 = 0;
+        for (int i = 0; i < changedCount; i++)
+        {
+            box.x = SDL_min(box.x, changed[i] % columns);
+            box.y = SDL_min(box.y, changed[i] / columns);
+            x1 = SDL_max(x1, changed[i] % columns + 1);
+            y1 = SDL_max(y1, changed[i] / columns + 1);
+        }
+        box.w = x1 - box.x;
+        box.h = y1 - box.y;
+        SDL_UpdateTexture(texture, &box, &texels[box.y * columns + box.x], columns * sizeof(Uint32));
+    }
+
+public:
+    CellGrid()
+    {
+        texture = NULL;
+        texels = pending = NULL;
+        touched = changed = NULL;
+    }
+
+    ~CellGrid()
+    {
+        SDL_DestroyTexture(texture);
+        free(texels);
+        free(pending);
+        free(touched);
+        free(changed);
+    }
+
+    int Initialize(SDL_Renderer* renderer, int columns, int rows)
+    {
+        this->columns = columns;
+        this->rows = rows;
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "nearest");    // Sharp cell edges when stretched
+        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, columns, rows);
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+        if (texture == NULL)
+        {
+            return 0;
+        }
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
+
+        texels = (Uint32*)malloc(columns * rows * sizeof(Uint32));
+        pending = (Uint32*)malloc(columns * rows * sizeof(Uint32));
+        touched = (int*)malloc(2 * columns * rows * sizeof(int));
+        changed = (int*)malloc(columns * rows * sizeof(int));
+        for (int i = 0; i < columns * rows; i++)
+        {
+            texels[i] = pending[i] = BACKGROUND_COLOR;
+        }
+        SDL_UpdateTexture(texture, NULL, texels, columns * sizeof(Uint32));
+        touchedCount = previousCount = 0;
+        return 1;
+    }
+
+    // Cells set in the previous frame go back to the background
+    void Begin()
+    {
+        for (int i = 0; i < touchedCount; i++)
+        {
+            pending[touched[i]] = BACKGROUND_COLOR;
+            touched[columns * rows + i] = touched[i];
+        }
+        previousCount = touchedCount;
+        touchedCount = 0;
+    }
+
+    void SetCell(int column, int row, Uint32 color)
+    {
+        if (column >= 0 && column < columns && row >= 0 && row < rows && touchedCount < columns * rows)
+        {
+            pending[row * columns + column] = color;
+            touched[touchedCount++] = row * columns + column;
+        }
+    }
+
+    void Upload()
+    {
+        changedCount = 0;
+        for (int i = 0; i < touchedCount + previousCount; i++)
+        {
+            int cell = i < touchedCount ? touched[i] : touched[columns * rows + i - touchedCount];
+            if (texels[cell] != pending[cell])
+            {
+                texels[cell] = pending[cell];
+                changed[changedCount++] = cell;
+            }
+        }
+        UploadChanged();
+    }
+
+    // Cut a rectangle of cells to the grid
+    void ClipCells(SDL_Rect* cells)
+    {
+        SDL_Rect all = { 0, 0, columns, rows }, inside = { 0, 0, 0, 0 };
+        SDL_IntersectRect(cells, &all, &inside);
+        *cells = inside;
+    }
+
+    void Draw(SDL_Renderer* renderer, const SDL_Rect* cells, const SDL_Rect* board)
+    {
+        SDL_RenderCopy(renderer, texture, cells, board);
+    }
+};
+
+// Everything the game draws goes through this interface, backends decide how it reaches the window.
+// Cells and dots are placed in board cells, text in window pixels.
+class Renderer
+{
+public:
+    virtual ~Renderer() {}
+
+    virtual int Initialize(SDL_Renderer* target, Options options) = 0;
+    virtual int NeedsWindow() { return 1; }
+    virtual void BeginFrame(FrameLayout layout) = 0;
+    virtual void SetCamera(const Camera* camera) = 0;   // Board shapes drawn from now on are seen through it
+    virtual void DrawCell(float column, float row, Uint32 color) = 0;
+    virtual void DrawDot(float column, float row, Uint32 color) = 0;
+    virtual void DrawRun(float column, float row, int columns, int rows, int phase, Uint32 color) = 0;   // Straight run of segments, phase 1 = the top-left one is small
+    virtual void DrawBar(double remaining) = 0;  // Bonus progress bar, remaining fraction of its time
+    virtual void DrawStatus(Uint32 elapsedTime, int points) = 0;    // Info panel values
+    virtual void DrawText(int x, int y, const char* text, float scale) = 0;
+    virtual void DrawBox(int x, int y, int width, int height, Uint32 outlineColor, Uint32 fillColor) = 0;   // Rectangle in window pixels, NO_COLOR is not drawn
+    virtual void EndFrame() = 0;    // Frame is copied to the target, presenting is left to the caller
+    virtual void Refresh() = 0;     // Copy the last frame to the target again
+};
+
+// Segments on each board cell, plus a pyramid of coarser levels whose cells sum 2x2 blocks of the level below.
+// A change touches one cell per level, so collisions and the minimap never scan the board or the snake.
+class OccupancyGrid
+{
+private:
+    int* levels[OCCUPANCY_LEVELS];
+    int columns[OCCUPANCY_LEVELS];
+    int rows[OCCUPANCY_LEVELS];
+    int levelCount;
+
+public:
+    OccupancyGrid()
+    {
+        levelCount = 0;
+    }
+
+    ~OccupancyGrid()
+    {
+        for (int i = 0; i < levelCount; i++)
+        {
+            free(levels[i]);
+        }
+    }
+
+    // Levels are added until one cell covers the whole board, all of them start empty
+    void Initialize(int boardColumns, int boardRows)
+    {
+        for (int i = 0; i < levelCount; i++)
+        {
+            free(levels[i]);
+        }
+        levelCount = 0;
+        do
+        {
+            int shift = levelCount;
+            columns[shift] = (boardColumns + (1 << shift) - 1) >> shift;
+            rows[shift] = (boardRows + (1 << shift) - 1) >> shift;
+            levels[shift] = (int*)calloc(columns[shift] * rows[shift], sizeof(int));
+            levelCount++;
+        } while (levelCount < OCCUPANCY_LEVELS && (columns[levelCount - 1] > 1 || rows[levelCount - 1] > 1));
+    }
+
+    // Segments entering (delta 1) or leaving (delta -1) a cell
+    void Change(int column, int row, int delta)
+    {
+        if (column < 0 || column >= columns[0] || row < 0 || row >= rows[0])
+        {
+            return;
+        }
+        for (int i = 0; i < levelCount; i++)
+        {
+            levels[i][(row >> i) * columns[i] + (column >> i)] += delta;
+        }
+    }
+
+    int Count(int column, int row)
+    {
+        if (column < 0 || column >= columns[0] || row < 0 || row >= rows[0])
+        {
+            return 0;
+        }
+        return levels[0][row * columns[0] + column];
+    }
+
+    // Occupied cells of the finest level at most size cells across, returns its shift
+    int Downsample(int size, Uint8* cells, int* levelColumns, int* levelRows)
+    {
+        int level = 0;
+        while (level + 1 < levelCount && (columns[level] > size || rows[level] > size))
+        {
+            level++;
+        }
+        *levelColumns = SDL_min(columns[level], size);
+        *levelRows = SDL_min(rows[level], size);
+        for (int row = 0; row < *levelRows; row++)
+        {
+            for (int column = 0; column < *levelColumns; column++)
+            {
+                cells[row * *levelColumns + column] = levels[level][row * columns[level] + column] > 0;
+            }
+        }
+        return level;
+    }
+};
+
+class Snake
+{
+private:
+    int length;
+    Segment* body;
+	Segment* head;  // Pointer to body[0]
+    Segment* previous;  // Body before the last move
+    OccupancyGrid occupancy;
+    int rightEdge;
+    int bottomEdge;
+    Direction direction;
+    Uint32 lastMoveTime;
+    int moveInterval;   // Speed
+    int mayChangeDirection; // Flag to prevent changing direction twice in one move
+
+    int IsOppositeDirection(Direction newDirection)
+    {
+        return ((direction == UP && newDirection == DOWN) ||
+            (direction == DOWN && newDirection == UP) ||
+            (direction == LEFT && newDirection == RIGHT) ||
+            (direction == RIGHT && newDirection == LEFT)) ? 1 : 0;
+    }
+
+    int IsDirectionIntoEdge(Direction newDirection)
+    {
+        return ((newDirection == LEFT && head->x <= LEFT_EDGE) ||
+            (newDirection == RIGHT && head->x >= rightEdge - SEGMENT_SIZE) ||
+            (newDirection == UP && head->y <= TOP_EDGE) ||
+            (newDirection == DOWN && head->y >= bottomEdge - SEGMENT_SIZE)) ? 1 : 0;
+    }
+
+    void ChangeDirectionOnEdge()
+    {
+        if (direction == LEFT && head->x <= LEFT_EDGE)
+        {
+            direction = IsDirectionIntoEdge(UP) ? DOWN : UP;
+        }
+        else if (direction == RIGHT && head->x >= rightEdge - SEGMENT_SIZE)
+        {
+            direction = IsDirectionIntoEdge(DOWN) ? UP : DOWN;
+        }
+        else if (direction == UP && head->y <= TOP_EDGE)
+        {
+            direction = IsDirectionIntoEdge(RIGHT) ? LEFT : RIGHT;
+        }
+        else if (direction == DOWN && head->y >= bottomEdge - SEGMENT_SIZE)
+        {
+            direction = IsDirectionIntoEdge(LEFT) ? RIGHT : LEFT;
+        }
+    }
+
+    // Segments are counted on the occupancy grid by their cell
+    void Occupy(Segment segment, int delta)
+    {
+        occupancy.Change((segment.x - LEFT_EDGE) / SEGMENT_SIZE, (segment.y - TOP_EDGE) / SEGMENT_SIZE, delta);
+    }
+
+    // Direction from a segment to the next one, which is a neighbour or on the same cell
+    static int StepBetween(Segment from, Segment to)
+    {
+        if (to.x != from.x)
+        {
+            return to.x > from.x ? RIGHT : LEFT;
+        }
+        return to.y != from.y ? (to.y > from.y ? DOWN : UP) : KEYFRAME_STAY;
+    }
+
+    static Segment StepFrom(Segment from, int step)
+    {
+        from.x += step == RIGHT ? SEGMENT_SIZE : (step == LEFT ? -SEGMENT_SIZE : 0);
+        from.y += step == DOWN ? SEGMENT_SIZE : (step == UP ? -SEGMENT_SIZE : 0);
+        return from;
+    }
+
+    // Body of a keyframe is rebuilt from the head, previous positions are the current ones
+    void LoadBody(const Uint8* steps)
+    {
+        body = (Segment*)realloc(body, length * sizeof(Segment));
+        previous = (Segment*)realloc(previous, length * sizeof(Segment));
+        head = &body[0];
+        for (int i = 1; i < length; i++)
+        {
+            body[i] = StepFrom(body[i - 1], steps[(i - 1) / 2] >> ((i - 1) % 2 * 4) & 15);
+        }
+        memcpy(previous, body, length * sizeof(Segment));
+        for (int i = 0; i < length; i++)
+        {
+            Occupy(body[i], 1);
+        }
+    }
+
+public: 
+    Snake()
+    {
+        body = NULL;
+        previous = NULL;
+    }
+
+    ~Snake()
+    {
+        free(body);
+        free(previous);
+    }
+
+    // Start in the middle of a board of the given size
+    void Initialize(int columns, int rows, Uint32 startTime)
+    {
+        length = INITIAL_SNAKE_LENGTH;
+        body = (Segment*)realloc(body, length * sizeof(Segment));
+        previous = (Segment*)realloc(previous, length * sizeof(Segment));
+        head = &body[0];
+        rightEdge = LEFT_EDGE + columns * SEGMENT_SIZE;
+        bottomEdge = TOP_EDGE + rows * SEGMENT_SIZE;
+        direction = RIGHT;
+        lastMoveTime = startTime;
+		moveInterval = INITIAL_SNAKE_MOVE_INTERVAL;
+		mayChangeDirection = 1;
+        occupancy.Initialize(columns, rows);
+        for (int i = 0; i < length; i++)
+        {
+            body[i].x = LEFT_EDGE + (columns / 2 - i) * SEGMENT_SIZE;
+            body[i].y = TOP_EDGE + (rows / 2) * SEGMENT_SIZE;
+            previous[i] = body[i];
+            Occupy(body[i], 1);
+        }
+    }
+
+    // Returns 1 if the direction was taken
+    int SetDirection(Direction newDirection)
+    {
+        if (mayChangeDirection && !IsOppositeDirection(newDirection) && !IsDirectionIntoEdge(newDirection))
+        {
+            direction = newDirection;
+			mayChangeDirection = 0;
+            return 1;
+        }
+        return 0;
+    }
+
+    int CollidesWith(Segment segment)
+    {
+        return occupancy.Count((segment.x - LEFT_EDGE) / SEGMENT_SIZE, (segment.y - TOP_EDGE) / SEGMENT_SIZE) > 0;
+    }
+
+    int HeadCollidesWith(Segment segment)
+    {
+        return (head->x == segment.x && head->y == segment.y) ? 1 : 0;
+    }
+
+    // Another segment shares the head's cell
+    int SelfCollision()
+    {
+        return occupancy.Count((head->x - LEFT_EDGE) / SEGMENT_SIZE, (head->y - TOP_EDGE) / SEGMENT_SIZE) > 1;
+    }
+
+    void Grow()
+    {
+        length++;
+        body = (Segment*)realloc(body, length * sizeof(Segment));
+        body[length - 1] = body[length - 2];
+        previous = (Segment*)realloc(previous, length * sizeof(Segment));
+        previous[length - 1] = previous[length - 2];
+		head = &body[0];
+        Occupy(body[length - 1], 1);
+    }
+
+    void Shrink(int count)
+    {
+        int oldLength = length;
+        length -= count;
+        if (length < INITIAL_SNAKE_LENGTH)
+        {
+            length = INITIAL_SNAKE_LENGTH; // Minimum length
+        }
+        for (int i = length; i < oldLength; i++)
+        {
+            Occupy(body[i], -1);
+        }
+        body = (Segment*)realloc(body, length * sizeof(Segment));
+        previous = (Segment*)realloc(previous, length * sizeof(Segment));
+        head = &body[0];
+    }
+
+    void Move(Uint32 currentTime)
+    {
+		// Move snake with a fixed interval
+        if (currentTime - lastMoveTime >= moveInterval)
+        {
+            ChangeDirectionOnEdge();
+            memcpy(previous, body, length * sizeof(Segment));
+            Occupy(body[length - 1], -1);
+
+            for (int i = length - 1; i > 0; i--)
+            {
                 body[i] = body[i - 1];  // Shift body segments
             }
 
-            // Move head based on current direction
-            switch (direction)
+            // Move head based on current direction
+            switch (direction)
+            {
+                case UP:
+                    head->y -= SEGMENT_SIZE;
+                    break;
+                case DOWN:
+                    head->y += SEGMENT_SIZE;
+                    break;
+                case LEFT:
+                    head->x -= SEGMENT_SIZE;
+                    break;
+                case RIGHT:
+                    head->x += SEGMENT_SIZE;
+                    break;
+            }
+            Occupy(*head, 1);
+
+            lastMoveTime = currentTime;
+			mayChangeDirection = 1;
+        }
+    }
+
+    Uint32 GetNextMoveTime()
+    {
+        return lastMoveTime + moveInterval;
+    }
+
+    int GetMoveInterval() const
+    {
+        return moveInterval;
+    }
+
+    Direction GetDirection() const
+    {
+        return direction;
+    }
+
+    // The player turned the snake since its last move
+    int HasTurned() const
+    {
+        return mayChangeDirection == 0;
+    }
+
+    // A move interval of 0 would make every step a move
+    void AdjustSpeed(float factor)
+    {
+        moveInterval = SDL_max((int)(moveInterval * factor), MIN_SNAKE_MOVE_INTERVAL);
+    }
+
+    int GetLength() const
+    {
+        return length;
+    }
+
+    // Keyframe of the snake with times relative to the game's start: fields, then the steps from the head
+    // to each next segment, two to a byte
+    int Save(Uint8* out, Uint32 startTime) const
+    {
+        Uint32 fields[] = { (Uint32)length, (Uint32)direction, lastMoveTime - startTime, (Uint32)moveInterval, (Uint32)mayChangeDirection, (Uint32)head->x, (Uint32)head->y };
+        int size = 0;
+        for (int i = 0; i < (int)SDL_arraysize(fields); i++)
+        {
+            size += PutVarint(out + size, fields[i]);
+        }
+        memset(out + size, 0, length / 2);
+        for (int i = 1; i < length; i++)
+        {
+            out[size + (i - 1) / 2] |= StepBetween(body[i - 1], body[i]) << ((i - 1) % 2 * 4);
+        }
+        return size + length / 2;
+    }
+
+    // Returns 0 if the keyframe is cut short
+    int Load(const Uint8** next, const Uint8* end, int columns, int rows, Uint32 startTime)
+    {
+        length = (int)TakeVarint(next, end);
+        direction = (Direction)(TakeVarint(next, end) & 3);
+        lastMoveTime = startTime + TakeVarint(next, end);
+        moveInterval = (int)TakeVarint(next, end);
+        mayChangeDirection = (int)TakeVarint(next, end);
+        Segment start = { (int)TakeVarint(next, end), (int)TakeVarint(next, end) };
+        if (length < 1 || end - *next < length / 2)
+        {
+            return 0;
+        }
+        rightEdge = LEFT_EDGE + columns * SEGMENT_SIZE;
+        bottomEdge = TOP_EDGE + rows * SEGMENT_SIZE;
+        occupancy.Initialize(columns, rows);
+        body = (Segment*)realloc(body, sizeof(Segment));
+        body[0] = start;
+        LoadBody(*next);
+        *next += length / 2;
+        return 1;
+    }
+
+    // Copy the body & its timing for drawing, the snapshot's arrays only grow with the snake
+    void Capture(Snapshot* snapshot)
+    {
+        if (length > snapshot->capacity)
+        {
+            snapshot->capacity = length * 2;
+            snapshot->body = (Segment*)realloc(snapshot->body, snapshot->capacity * sizeof(Segment));
+            snapshot->previous = (Segment*)realloc(snapshot->previous, snapshot->capacity * sizeof(Segment));
+        }
+        snapshot->length = length;
+        memcpy(snapshot->body, body, length * sizeof(Segment));
+        memcpy(snapshot->previous, previous, length * sizeof(Segment));
+        snapshot->moveTime = lastMoveTime;
+        snapshot->moveInterval = moveInterval;
+
+        if (snapshot->minimap == NULL)
+        {
+            snapshot->minimap = (Uint8*)malloc(MINIMAP_CELLS * MINIMAP_CELLS);
+        }
+        snapshot->minimapShift = occupancy.Downsample(MINIMAP_CELLS, snapshot->minimap, &snapshot->minimapColumns, &snapshot->minimapRows);
+    }
+};
+
+// Rules of one game. Steps happen exactly when they are due and randomness comes from the game's own
+// seed, so a game is reproduced by its seed & the ticks its steering arrived before.
+class Simulation
+{
+private:
+    Snake snake;
+    Segment food;
+    Segment bonus;
+    Uint32 random;  // Generator state
+    Uint32 startTime;
+    Uint32 currentTime; // Of the last step
+    Uint32 lastSpeedUpTime;
+    Uint32 lastBonusTime;
+    int points;
+    int bonusActive;
+    int columns;
+    int rows;
+    int tick;   // Steps since the start
+    GameState state;
+    EventRing* telemetry;   // NULL = events are not emitted
+
+    void Emit(EventType type, Sint32 value)
+    {
+        if (telemetry != NULL)
+        {
+            telemetry->Emit(type, tick, currentTime - startTime, value);
+        }
+    }
+
+    void GenerateFood()
+    {
+        do
+        {
+            food.x = LEFT_EDGE + RandomInt(&random, 0, columns - 1) * SEGMENT_SIZE;
+            food.y = TOP_EDGE + RandomInt(&random, 0, rows - 1) * SEGMENT_SIZE;
+		} while (snake.CollidesWith(food) || (bonus.x == food.x && bonus.y == food.y)); // Prevent from spawning on snake or bonus
+    }
+
+    void GenerateBonus()
+    {
+        do
+        {
+            bonus.x = LEFT_EDGE + RandomInt(&random, 0, columns - 1) * SEGMENT_SIZE;
+            bonus.y = TOP_EDGE + RandomInt(&random, 0, rows - 1) * SEGMENT_SIZE;
+		} while (snake.CollidesWith(bonus) || (bonus.x == food.x && bonus.y == food.y));    // Prevent from spawning on snake or food
+        bonusActive = 1;
+        Emit(EVENT_BONUS_SPAWNED, (bonus.y - TOP_EDGE) / SEGMENT_SIZE * columns + (bonus.x - LEFT_EDGE) / SEGMENT_SIZE);
+    }
+
+    void HandleBonus()
+    {
+		// Deactivate bonus if expired
+        if (bonusActive && currentTime - lastBonusTime >= BONUS_DURATION)
+        {
+            bonusActive = 0;
+			lastBonusTime = currentTime;
+            Emit(EVENT_BONUS_EXPIRED, 0);
+        }
+
+		// Try to generate bonus if the interval has passed
+        if (!bonusActive && currentTime - lastBonusTime >= BONUS_INTERVAL)
+        {
+            if (RandomInt(&random, 1, 100) <= BONUS_PROBABILITY)
+            {
+                GenerateBonus();
+            }
+            lastBonusTime = currentTime;
+        }
+
+		// Handle collision if active
+        if (bonusActive && snake.HeadCollidesWith(bonus))
+        {
+			points += BONUS_POINTS;
+            bonusActive = 0;
+            lastBonusTime = currentTime;
+			if (RandomInt(&random, 0, 1) == 0)   // Randomly choose bonus effect
+            {
+                snake.Shrink(BONUS_SHRINK_COUNT);
+                Emit(EVENT_SHRINK, snake.GetLength());
+            }
+            else
+            {
+                snake.AdjustSpeed(BONUS_SLOW_DOWN_FACTOR);
+                Emit(EVENT_SLOW_DOWN, snake.GetMoveInterval());
+            }
+        }
+    }
+
+public:
+    Simulation()
+    {
+        telemetry = NULL;
+    }
+
+    void SetTelemetry(EventRing* ring)
+    {
+        telemetry = ring;
+    }
+
+    void Initialize(int boardColumns, int boardRows, Uint32 seed, Uint32 time)
+    {
+        columns = boardColumns;
+        rows = boardRows;
+        random = SeedRandom(seed);
+        startTime = time;
+        currentTime = time;
+        lastSpeedUpTime = time;
+        lastBonusTime = time;
+        snake.Initialize(columns, rows, time);
+        bonus.x = bonus.y = -1;
+        GenerateFood();
+		bonusActive = 0;
+        points = 0;
+        tick = 0;
+        state = PLAYING;
+        Emit(EVENT_START, (Sint32)seed);
+    }
+
+    // Returns 1 if the snake takes the new direction
+    int Steer(Direction direction)
+    {
+        return state == PLAYING && snake.SetDirection(direction);
+    }
+
+    // When the game changes on its own: the snake moves, it speeds up or the bonus changes
+    Uint32 NextTickTime()
+    {
+        Uint32 nextTick = snake.GetNextMoveTime();
+        Uint32 bonusTick = lastBonusTime + (bonusActive ? BONUS_DURATION : BONUS_INTERVAL);
+        if (lastSpeedUpTime + SPEED_UP_INTERVAL < nextTick)
+        {
+            nextTick = lastSpeedUpTime + SPEED_UP_INTERVAL;
+        }
+        return bonusTick < nextTick ? bonusTick : nextTick;
+    }
+
+    // One tick at the time it was due. Food & bonus are taken right after the move that reaches them.
+    void Step()
+    {
+        currentTime = NextTickTime();
+        tick++;
+		if (currentTime - lastSpeedUpTime >= SPEED_UP_INTERVAL) // Speed up
+        {
+            snake.AdjustSpeed(SPEED_UP_FACTOR);
+            lastSpeedUpTime = currentTime;
+            Emit(EVENT_SPEED_UP, snake.GetMoveInterval());
+        }
+
+		snake.Move(currentTime);    // Move & check for collision with itself
+        if (snake.SelfCollision())
+        {
+            state = GAME_OVER;
+            Emit(EVENT_DEATH, points);
+            return;
+        }
+
+        HandleBonus();
+		if (snake.HeadCollidesWith(food))   // Handle food collision
+        {
+            snake.Grow();
+            GenerateFood();
+			points += FOOD_POINTS;
+            Emit(EVENT_FOOD, points);
+        }
+    }
+
+    // Everything but the view settings of a snapshot
+    void Capture(Snapshot* snapshot)
+    {
+        snapshot->state = state;
+        snapshot->time = currentTime;
+        snapshot->startTime = startTime;
+        snapshot->nextTick = NextTickTime();
+        snapshot->points = points;
+        snapshot->food = food;
+        snapshot->bonus = bonus;
+        snapshot->bonusActive = bonusActive;
+        snapshot->bonusTime = lastBonusTime;
+        snapshot->columns = columns;
+        snapshot->rows = rows;
+        snake.Capture(snapshot);
+    }
+
+    // Keyframe of the whole game, times are relative to its start so it loads onto any clock
+    int Save(Uint8* out) const
+    {
+        Uint32 fields[] = { random, currentTime - startTime, lastSpeedUpTime - startTime, lastBonusTime - startTime, (Uint32)points, (Uint32)bonusActive,
+            (Uint32)tick, (Uint32)state, (Uint32)(food.x + 1), (Uint32)(food.y + 1), (Uint32)(bonus.x + 1), (Uint32)(bonus.y + 1) };   // No bonus yet is -1
+        int size = 0;
+        for (int i = 0; i < (int)SDL_arraysize(fields); i++)
+        {
+            size += PutVarint(out + size, fields[i]);
+        }
+        return size + snake.Save(out + size, startTime);
+    }
+
+    // Keyframe saved on a board of the same size, returns 0 if it is cut short
+    int Load(const Uint8** next, const Uint8* end, int boardColumns, int boardRows, Uint32 time)
+    {
+        columns = boardColumns;
+        rows = boardRows;
+        startTime = time;
+        random = TakeVarint(next, end);
+        currentTime = time + TakeVarint(next, end);
+        lastSpeedUpTime = time + TakeVarint(next, end);
+        lastBonusTime = time + TakeVarint(next, end);
+        points = (int)TakeVarint(next, end);
+        bonusActive = (int)TakeVarint(next, end);
+        tick = (int)TakeVarint(next, end);
+        state = (GameState)TakeVarint(next, end);
+        food.x = (int)TakeVarint(next, end) - 1;
+        food.y = (int)TakeVarint(next, end) - 1;
+        bonus.x = (int)TakeVarint(next, end) - 1;
+        bonus.y = (int)TakeVarint(next, end) - 1;
+        return snake.Load(next, end, columns, rows, time);
+    }
+
+    // Most bytes Save can write
+    int SaveBound() const
+    {
+        return KEYFRAME_FIELDS * VARINT_MAX_BYTES + snake.GetLength() / 2;
+    }
+
+    GameState GetState() const { return state; }
+    int GetTick() const { return tick; }
+    Uint32 GetTime() const { return currentTime; }
+    Uint32 GetStartTime() const { return startTime; }
+    int GetPoints() const { return points; }
+    int GetLength() const { return snake.GetLength(); }
+    Direction GetDirection() const { return snake.GetDirection(); }
+    int HasTurned() const { return snake.HasTurned(); }
+    Uint32 GetElapsedTime() const { return currentTime - startTime; }
+};
+
+// Steering of one game, each accepted turn is a varint of (ticks since the previous turn) << 2 | direction
+class InputLog
+{
+private:
+    Uint8* bytes;
+    int length;
+    int capacity;
+    int lastTick;
+
+public:
+    InputLog()
+    {
+        bytes = NULL;
+        capacity = 0;
+        Clear();
+    }
+
+    ~InputLog()
+    {
+        free(bytes);
+    }
+
+    void Clear()
+    {
+        length = 0;
+        lastTick = 0;
+    }
+
+    void Add(int tick, Direction direction)
+    {
+        if (length + VARINT_MAX_BYTES > capacity)
+        {
+            capacity = capacity * 2 + 64;
+            bytes = (Uint8*)realloc(bytes, capacity);
+        }
+        length += PutVarint(bytes + length, (Uint32)(tick - lastTick) << 2 | direction);
+        lastTick = tick;
+    }
+
+    const Uint8* GetBytes() const { return bytes; }
+    int GetLength() const { return length; }
+    int GetLastTick() const { return lastTick; }
+};
+
+// Full states of a game every REPLAY_KEYFRAME_INTERVAL ticks. Each entry is its size, the tick, where the input log
+// stood at that tick, then the simulation's keyframe.
+class KeyframeLog
+{
+private:
+    Uint8* bytes;
+    int length;
+    int capacity;
+
+public:
+    KeyframeLog()
+    {
+        bytes = NULL;
+        length = 0;
+        capacity = 0;
+    }
+
+    ~KeyframeLog()
+    {
+        free(bytes);
+    }
+
+    void Clear()
+    {
+        length = 0;
+    }
+
+    // The entry is written past room for its size, then moved next to it
+    void Add(const Simulation* simulation, const InputLog* inputs)
+    {
+        int bound = 4 * VARINT_MAX_BYTES + simulation->SaveBound();
+        if (length + bound > capacity)
+        {
+            capacity = (length + bound) * 2;
+            bytes = (Uint8*)realloc(bytes, capacity);
+        }
+        Uint8* entry = bytes + length + VARINT_MAX_BYTES;
+        int size = PutVarint(entry, simulation->GetTick());
+        size += PutVarint(entry + size, inputs->GetLength());
+        size += PutVarint(entry + size, inputs->GetLastTick());
+        size += simulation->Save(entry + size);
+        length += PutVarint(bytes + length, size);
+        memmove(bytes + length, entry, size);
+        length += size;
+    }
+
+    const Uint8* GetBytes() const { return bytes; }
+    int GetLength() const { return length; }
+};
+
+// Plays a recorded game into a simulation, turns are applied before the tick they arrived before.
+// Seeks restore the last keyframe at or before the wanted tick and play on from there.
+class Replayer
+{
+private:
+    ReplayHeader header;
+    const Uint8* data;  // Input log, then the keyframes
+    Uint8* buffer;      // Holds the data of games read from files
+    int capacity;
+    const Uint8** keyframes;    // Entries, past their size
+    int* keyframeTicks;
+    int keyframeCount;
+    int keyframeCapacity;
+    const Uint8* next;  // Undecoded turns
+    const Uint8* end;
+    int turnTick;       // Of the decoded turn, -1 once there are none
+    Direction turn;
+
+    void Decode()
+    {
+        Uint32 value;
+        int read = GetVarint(next, end, &value);
+        next += read;
+        turnTick = read > 0 ? turnTick + (int)(value >> 2) : -1;
+        turn = (Direction)(value & 3);
+    }
+
+    // Entries are found once per game, a damaged one ends the list
+    void Index()
+    {
+        const Uint8* entry = data + header.logLength;
+        const Uint8* last = entry + header.keyframeLength;
+        Uint32 size;
+        int read;
+        keyframeCount = 0;
+        while ((read = GetVarint(entry, last, &size)) > 0 && size <= (Uint32)(last - entry - read))
+        {
+            if (keyframeCount == keyframeCapacity)
+            {
+                keyframeCapacity = keyframeCapacity * 2 + 16;
+                keyframes = (const Uint8**)realloc(keyframes, keyframeCapacity * sizeof(const Uint8*));
+                keyframeTicks = (int*)realloc(keyframeTicks, keyframeCapacity * sizeof(int));
+            }
+            entry += read;
+            keyframes[keyframeCount] = entry;
+            keyframeTicks[keyframeCount++] = (int)TakeVarint(&entry, last);
+            entry = keyframes[keyframeCount - 1] + size;
+        }
+    }
+
+    // The turns continue from where the log stood at the keyframe, returns 0 if it is damaged
+    int Restore(Simulation* simulation, int index)
+    {
+        const Uint8* entry = keyframes[index];
+        const Uint8* last = data + header.logLength + header.keyframeLength;
+        TakeVarint(&entry, last);
+        Uint32 offset = TakeVarint(&entry, last);
+        int logTick = (int)TakeVarint(&entry, last);
+        if (offset > (Uint32)header.logLength || simulation->Load(&entry, last, header.columns, header.rows, simulation->GetStartTime()) == 0)
+        {
+            return 0;
+        }
+        next = data + offset;
+        end = data + header.logLength;
+        turnTick = logTick;
+        Decode();
+        return 1;
+    }
+
+public:
+    Replayer()
+    {
+        data = NULL;
+        buffer = NULL;
+        capacity = 0;
+        keyframes = NULL;
+        keyframeTicks = NULL;
+        keyframeCount = 0;
+        keyframeCapacity = 0;
+    }
+
+    ~Replayer()
+    {
+        free(buffer);
+        free(keyframes);
+        free(keyframeTicks);
+    }
+
+    // Next game of a replay file, returns 0 past the last one
+    int Load(FILE* file)
+    {
+        if (ReadReplay(file, &header, &buffer, &capacity) == 0)
+        {
+            return 0;
+        }
+        data = buffer;
+        Index();
+        return 1;
+    }
+
+    // Archived game, played straight from its payload. 0 for a damaged record, whose game can't be played.
+    int Attach(const ArchiveRecord* record, const Uint8* payload)
+    {
+        Uint32 counts = record->ticks | record->points | record->logLength | record->keyframeInterval | record->keyframeLength;
+        if (IsBoardSize(record->columns, record->rows) == 0 || counts > SDL_MAX_SINT32)   // A count with the top bit set is no int
+        {
+            return 0;
+        }
+        header.columns = (int)record->columns;
+        header.rows = (int)record->rows;
+        header.seed = record->seed;
+        header.ticks = (int)record->ticks;
+        header.points = (int)record->points;
+        header.logLength = (int)record->logLength;
+        header.keyframeInterval = (int)record->keyframeInterval;
+        header.keyframeLength = (int)record->keyframeLength;
+        data = payload;
+        Index();
+        return 1;
+    }
+
+    void Start(Simulation* simulation, Uint32 time)
+    {
+        simulation->Initialize(header.columns, header.rows, header.seed, time);
+        next = data;
+        end = data + header.logLength;
+        turnTick = 0;
+        Decode();
+    }
+
+    // Turns due before the next tick
+    void Turn(Simulation* simulation)
+    {
+        while (turnTick == simulation->GetTick())
+        {
+            simulation->Steer(turn);
+            Decode();
+        }
+    }
+
+    void Step(Simulation* simulation)
+    {
+        Turn(simulation);
+        simulation->Step();
+    }
+
+    // Whole game from the start, returns the number of ticks played
+    int Play(Simulation* simulation)
+    {
+        Start(simulation, 0);
+        while (simulation->GetTick() < header.ticks && simulation->GetState() == PLAYING)
+        {
+            Step(simulation);
+        }
+        return simulation->GetTick();
+    }
+
+    // A started simulation moves to the tick, or to the end of the game if it ends first. Playing on from
+    // the current tick is kept when no keyframe lies between it and the target.
+    void Seek(Simulation* simulation, int target)
+    {
+        int index = -1;
+        while (index + 1 < keyframeCount && keyframeTicks[index + 1] <= target)
+        {
+            index++;
+        }
+        int from = index >= 0 ? keyframeTicks[index] : 0;
+        if (simulation->GetTick() > target || simulation->GetTick() < from)
+        {
+            if (index < 0 || Restore(simulation, index) == 0)
+            {
+                Start(simulation, simulation->GetStartTime());
+            }
+        }
+        while (simulation->GetTick() < target && simulation->GetState() == PLAYING)
+        {
+            Step(simulation);
+        }
+    }
+
+    const ReplayHeader* GetHeader() const { return &header; }
+    const Uint8* GetData() const { return data; }
+};
+
+// Whole file mapped read-only, the view stays valid until Close
+class MappedFile
+{
+private:
+    const Uint8* bytes;
+    Uint64 size;
+
+public:
+    MappedFile()
+    {
+        bytes = NULL;
+        size = 0;
+    }
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+#if defined(_WIN32)
+    void Map(const char* path)
+    {
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        LARGE_INTEGER length;
+        HANDLE mapping = file != INVALID_HANDLE_VALUE && GetFileSizeEx(file, &length) && length.QuadPart > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+        bytes = mapping != NULL ? (const Uint8*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+        size = bytes != NULL ? (Uint64)length.QuadPart : 0;
+        if (mapping != NULL)
+        {
+            CloseHandle(mapping);   // The view keeps the mapping alive
+        }
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(file);
+        }
+    }
+#else
+    void Map(const char* path)
+    {
+        int file = open(path, O_RDONLY);
+        struct stat status;
+        void* view = file >= 0 && fstat(file, &status) == 0 && status.st_size > 0 ? mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, file, 0) : MAP_FAILED;
+        bytes = view != MAP_FAILED ? (const Uint8*)view : NULL;
+        size = bytes != NULL ? (Uint64)status.st_size : 0;
+        if (file >= 0)
+        {
+            close(file);    // The mapping keeps the file open
+        }
+    }
+#endif
+
+    // Empty files can't be mapped and fail too
+    int Open(const char* path)
+    {
+        Close();
+        Map(path);
+        return bytes != NULL;
+    }
+
+    void Close()
+    {
+        if (bytes != NULL)
+        {
+#if defined(_WIN32)
+            UnmapViewOfFile(bytes);
+#else
+            munmap((void*)bytes, size);
+#endif
+        }
+        bytes = NULL;
+        size = 0;
+    }
+
+    const Uint8* GetBytes() const { return bytes; }
+    Uint64 GetSize() const { return size; }
+};
+
+// Appends games to an archive. The payload goes past the end of the last one and its record into the next
+// free slot of the index, the header is written last, so readers never see a game that is not complete.
+class ArchiveWriter
+{
+private:
+    FILE* file;
+    ArchiveHeader header;
+
+    int WriteHeader()
+    {
+        return SeekFile(file, 0) == 0 && fwrite(&header, sizeof(header), 1, file) == 1 && fflush(file) == 0;
+    }
+
+    // New archives start with an empty index of ARCHIVE_CAPACITY records, the payloads follow it. The file is sparse, so
+    // the first payload written past the index doesn't fill the unused part of it.
+    int Create(const char* path)
+    {
+        file = fopen(path, "w+b");
+        if (file == NULL)
+        {
+            printf("Can't create archive %s\n", path);
+            return 0;
+        }
+        MarkSparse(file);
+        memcpy(header.magic, ARCHIVE_MAGIC, 4);
+        header.version = ARCHIVE_VERSION;
+        header.recordSize = sizeof(ArchiveRecord);
+        header.capacity = ARCHIVE_CAPACITY;
+        header.count = 0;
+        header.end = sizeof(ArchiveHeader) + (Uint64)ARCHIVE_CAPACITY * sizeof(ArchiveRecord);
+        return WriteHeader();
+    }
+
+public:
+    ArchiveWriter()
+    {
+        file = NULL;
+    }
+
+    ~ArchiveWriter()
+    {
+        Close();
+    }
+
+    // An existing archive is appended to, a missing one is created
+    int Open(const char* path)
+    {
+        file = fopen(path, "r+b");
+        if (file == NULL)
+        {
+            return Create(path);
+        }
+        if (fread(&header, sizeof(header), 1, file) != 1 || IsArchiveHeader(&header) == 0)
+        {
+            printf("%s is not an archive of version %d\n", path, ARCHIVE_VERSION);
+            Close();
+            return 0;
+        }
+        return 1;
+    }
+
+    // Game that has just ended in the simulation, its payload is the input log & keyframes of the header
+    int Append(const ReplayHeader* game, const Simulation* simulation, const Uint8* log, const Uint8* keyframes)
+    {
+        if (header.count == header.capacity)
+        {
+            printf("The archive is full\n");
+            return 0;
+        }
+        ArchiveRecord record = { header.end, game->seed, (Uint32)game->points, (Uint32)game->ticks, simulation->GetElapsedTime(), (Uint32)simulation->GetLength(),
+            (Uint32)game->logLength, (Uint32)game->keyframeLength, (Uint32)game->keyframeInterval, (Uint32)game->columns, (Uint32)game->rows };
+        if (SeekFile(file, record.offset) != 0 || (int)fwrite(log, 1, game->logLength, file) != game->logLength ||
+            (int)fwrite(keyframes, 1, game->keyframeLength, file) != game->keyframeLength ||
+            SeekFile(file, sizeof(ArchiveHeader) + header.count * sizeof(ArchiveRecord)) != 0 || fwrite(&record, sizeof(record), 1, file) != 1)
+        {
+            return 0;
+        }
+        header.count++;
+        header.end += game->logLength + game->keyframeLength;
+        return WriteHeader();
+    }
+
+    void Close()
+    {
+        if (file != NULL)
+        {
+            fclose(file);
+            file = NULL;
+        }
+    }
+
+    int IsOpen() const { return file != NULL; }
+    Uint64 GetCount() const { return header.count; }
+};
+
+// Read-only archive, the index & payloads are used in place in the mapped file
+class ArchiveView
+{
+private:
+    MappedFile mapping;
+    const ArchiveHeader* header;
+    const ArchiveRecord* records;
+
+public:
+    ArchiveView()
+    {
+        header = NULL;
+        records = NULL;
+    }
+
+    // The used part of the index must lie within the file, an archive no game has been added to yet is only a header.
+    // Payloads are checked when they are used.
+    int Open(const char* path)
+    {
+        int mapped = mapping.Open(path) && mapping.GetSize() >= sizeof(ArchiveHeader);
+        header = (const ArchiveHeader*)mapping.GetBytes();
+        if (mapped == 0 || IsArchiveHeader(header) == 0 || mapping.GetSize() < sizeof(ArchiveHeader) + header->count * sizeof(ArchiveRecord))
+        {
+            printf("%s is not an archive of version %d\n", path, ARCHIVE_VERSION);
+            mapping.Close();
+            return 0;
+        }
+        records = (const ArchiveRecord*)(mapping.GetBytes() + sizeof(ArchiveHeader));
+        return 1;
+    }
+
+    // NULL if the record points past the end of the file
+    const Uint8* GetPayload(const ArchiveRecord* record) const
+    {
+        Uint64 length = (Uint64)record->logLength + record->keyframeLength;
+        return record->offset <= mapping.GetSize() && length <= mapping.GetSize() - record->offset ? mapping.GetBytes() + record->offset : NULL;
+    }
+
+    Uint64 GetCount() const { return header->count; }
+    const ArchiveRecord* GetRecord(Uint64 index) const { return &records[index]; }
+};
+
+// Persistent leaderboards per board size. Finished games go to an append-only log, one write each, so any number
+// of runners can share it. The best SCORE_TOP_K of every board are kept in an index that records how much of the
+// log it covers; it is brought up to date from the records appended since only when it is read, then mapped.
+class ScoreBoard
+{
+private:
+    char* logPath;
+    char* indexPath;
+    int log;    // Append descriptor, -1 when closed
+    MappedFile mapping;
+    ScoreIndexHeader* built;        // Last index rebuilt in memory
+    const ScoreIndexHeader* index;  // The mapped one, or the built one if it could not be saved
+
+    static const ScoreTable* Tables(const ScoreIndexHeader* header)
+    {
+        return (const ScoreTable*)(header + 1);
+    }
+
+    static int IndexSize(int tables)
+    {
+        return sizeof(ScoreIndexHeader) + tables * sizeof(ScoreTable);
+    }
+
+    int MapIndex()
+    {
+        const ScoreIndexHeader* header = mapping.Open(indexPath) && mapping.GetSize() >= sizeof(ScoreIndexHeader) ? (const ScoreIndexHeader*)mapping.GetBytes() : NULL;
+        index = header != NULL && memcmp(header->magic, SCORE_INDEX_MAGIC, 4) == 0 && header->version == SCORE_INDEX_VERSION &&
+            header->topK == SCORE_TOP_K && mapping.GetSize() >= (Uint64)IndexSize(header->tables) ? header : NULL;
+        return index != NULL;
+    }
+
+    // Keeps the best SCORE_TOP_K of the record's board, a board seen for the first time gets a table
+    void Insert(const ScoreRecord* record)
+    {
+        ScoreTable* tables = (ScoreTable*)Tables(built);
+        Uint32 i = 0;
+        while (i < built->tables && (tables[i].columns != record->columns || tables[i].rows != record->rows))
+        {
+            i++;
+        }
+        if (i == built->tables)
+        {
+            built = (ScoreIndexHeader*)realloc(built, IndexSize(++built->tables));
+            tables = (ScoreTable*)Tables(built);
+            memset(&tables[i], 0, sizeof(ScoreTable));
+            tables[i].columns = record->columns;
+            tables[i].rows = record->rows;
+        }
+
+        ScoreTable* table = &tables[i];
+        int at = table->count;
+        while (at > 0 && table->best[at - 1].points < record->points)
+        {
+            at--;
+        }
+        if (at < SCORE_TOP_K)
+        {
+            memmove(&table->best[at + 1], &table->best[at], (SDL_min((int)table->count, SCORE_TOP_K - 1) - at) * sizeof(ScoreRecord));
+            table->best[at] = *record;
+            table->count = SDL_min(table->count + 1, SCORE_TOP_K);
+        }
+    }
+
+    // Records from the given offset on, a record torn by a crashed writer is skipped by looking for the next valid one.
+    // Returns how far the log is covered, a record still being written at the end is left for later.
+    Uint64 ReadLog(Uint64 from, Uint64 size)
+    {
+        size_t length = (size_t)(size - from);
+        Uint8* bytes = (Uint8*)malloc(length);
+        FILE* file = fopen(logPath, "rb");
+        size_t at = 0;
+        if (bytes != NULL && file != NULL && SeekFile(file, from) == 0 && fread(bytes, 1, length, file) == length)
+        {
+            while (at + sizeof(ScoreRecord) <= length)
+            {
+                ScoreRecord record;
+                memcpy(&record, bytes + at, sizeof(record));
+                int valid = record.magic == SCORE_MAGIC && record.checksum == ScoreChecksum(&record);
+                if (valid)
+                {
+                    Insert(&record);
+                }
+                at += valid ? sizeof(record) : 1;
+            }
+        }
+        if (file != NULL)
+        {
+            fclose(file);
+        }
+        free(bytes);
+        return from + at;
+    }
+
+    // Written under a temporary name & renamed over the old index, so readers always map a whole one
+    int SaveIndex()
+    {
+        size_t length = strlen(indexPath) + 16;
+        char* temporary = (char*)malloc(length);
+        SDL_snprintf(temporary, length, "%s.%d", indexPath, ProcessId());
+        FILE* file = fopen(temporary, "wb");
+        int saved = file != NULL && fwrite(built, IndexSize(built->tables), 1, file) == 1;
+        saved = file != NULL && fclose(file) == 0 && saved && RenameOver(temporary, indexPath);
+        if (saved == 0)
+        {
+            remove(temporary);
+        }
+        free(temporary);
+        return saved;
+    }
+
+    // The current index plus the records appended since, a log shorter than the index covers is read from its start
+    void Rebuild(Uint64 size)
+    {
+        int keep = index != NULL && index->logSize <= size;
+        ScoreIndexHeader* copy = (ScoreIndexHeader*)malloc(IndexSize(keep ? index->tables : 0));
+        if (keep)
+        {
+            memcpy(copy, index, IndexSize(index->tables));
+        }
+        else
+        {
+            memcpy(copy->magic, SCORE_INDEX_MAGIC, 4);
+            copy->version = SCORE_INDEX_VERSION;
+            copy->logSize = 0;
+            copy->scanned = 0;
+            copy->tables = 0;
+            copy->topK = SCORE_TOP_K;
+        }
+        mapping.Close();
+        free(built);
+        built = copy;
+        Uint64 covered = ReadLog(built->logSize, size);    // Reading may move the index to grow it
+        built->logSize = covered;
+        built->scanned = size;
+        if (SaveIndex() == 0 || MapIndex() == 0)
+        {
+            index = built;
+        }
+    }
+
+public:
+    ScoreBoard()
+    {
+        logPath = NULL;
+        indexPath = NULL;
+        log = -1;
+        built = NULL;
+        index = NULL;
+    }
+
+    ~ScoreBoard()
+    {
+        if (log >= 0)
+        {
+            CloseDescriptor(log);
+        }
+        free(logPath);
+        free(indexPath);
+        free(built);
+    }
+
+    // The log is created if missing, the index is kept next to it
+    int Open(const char* path)
+    {
+        logPath = SDL_strdup(path);
+        indexPath = (char*)malloc(strlen(path) + strlen(SCORE_INDEX_SUFFIX) + 1);
+        strcpy(indexPath, path);
+        strcat(indexPath, SCORE_INDEX_SUFFIX);
+        log = OpenForAppend(path);
+        if (log < 0)
+        {
+            printf("Can't open score log %s, scores are not kept\n", path);
+        }
+        return log >= 0;
+    }
+
+    int Add(Uint32 columns, Uint32 rows, Uint32 points, Uint32 ticks, Uint32 duration, Uint32 seed)
+    {
+        ScoreRecord record = { SCORE_MAGIC, 0, columns, rows, points, ticks, duration, seed, (Sint64)time(NULL) };
+        record.checksum = ScoreChecksum(&record);
+        return AppendBytes(log, &record, sizeof(record));
+    }
+
+    // Best scores of a board, NULL if none were logged. Costs a lookup among the boards unless the log has changed size,
+    // a torn tail left by a crashed writer is read again only once more records follow it.
+    const ScoreTable* Top(Uint32 columns, Uint32 rows)
+    {
+        Uint64 size = FileSize(logPath);
+        if (index == NULL)
+        {
+            MapIndex();
+        }
+        if (index == NULL || index->scanned != size)
+        {
+            Rebuild(size);
+        }
+        const ScoreTable* tables = Tables(index);
+        for (Uint32 i = 0; i < index->tables; i++)
+        {
+            if (tables[i].columns == columns && tables[i].rows == rows)
+            {
+                return &tables[i];
+            }
+        }
+        return NULL;
+    }
+
+    int IsOpen() const { return log >= 0; }
+};
+
+// Checkpoints are written on a thread of their own, to a temporary file that is synced & renamed over the old one, so
+// a crash leaves either the old checkpoint or the new one whole. Saving only hands the bytes over; a checkpoint still
+// waiting when a newer one comes is dropped. The thread is started by the first save.
+class CheckpointWriter
+{
+private:
+    char* path;
+    char* temporary;
+    SDL_mutex* lock;
+    SDL_cond* changed;  // Work handed over, a write finished or closing
+    Uint8* pending;     // Waiting for the thread, NULL = none
+    int pendingSize;
+    Uint8* latest;      // Copy of the last checkpoint handed over, main thread only
+    int writing;        // The thread holds a checkpoint it has not written yet
+    int closing;
+    SDL_Thread* thread;
+
+    // Checkpoints handed over before closing are written too
+    static int SDLCALL WriterMain(void* data)
+    {
+        CheckpointWriter* writer = (CheckpointWriter*)data;
+        SDL_LockMutex(writer->lock);
+        while (writer->pending != NULL || writer->closing == 0)
+        {
+            if (writer->pending == NULL)
+            {
+                SDL_CondWait(writer->changed, writer->lock);
+                continue;
+            }
+            Uint8* bytes = writer->pending;
+            int size = writer->pendingSize;
+            writer->pending = NULL;
+            writer->writing = 1;
+            SDL_UnlockMutex(writer->lock);
+            if (writer->Write(bytes, size) == 0)
+            {
+                printf("Can't save checkpoint %s\n", writer->path);
+            }
+            free(bytes);
+            SDL_LockMutex(writer->lock);
+            writer->writing = 0;
+            SDL_CondBroadcast(writer->changed);
+        }
+        SDL_UnlockMutex(writer->lock);
+        return 0;
+    }
+
+    int Write(const Uint8* bytes, int size)
+    {
+        FILE* file = fopen(temporary, "wb");
+        int saved = file != NULL && fwrite(bytes, 1, size, file) == (size_t)size && SyncFile(file);
+        saved = file != NULL && fclose(file) == 0 && saved && RenameOver(temporary, path);
+        if (saved == 0)
+        {
+            remove(temporary);
+        }
+        return saved;
+    }
+
+    // Kept for a retry if the thread can't be created
+    int Start()
+    {
+        lock = lock != NULL ? lock : SDL_CreateMutex();
+        changed = changed != NULL ? changed : SDL_CreateCond();
+        pending = NULL;
+        writing = 0;
+        closing = 0;
+        thread = lock != NULL && changed != NULL ? SDL_CreateThread(WriterMain, "Checkpoint", this) : NULL;
+        if (thread == NULL)
+        {
+            printf("SDL_CreateThread error: %s\n", SDL_GetError());
+        }
+        return thread != NULL;
+    }
+
+public:
+    CheckpointWriter()
+    {
+        path = NULL;
+        temporary = NULL;
+        lock = NULL;
+        changed = NULL;
+        thread = NULL;
+        latest = NULL;
+    }
+
+    ~CheckpointWriter()
+    {
+        Close();
+    }
+
+    // The temporary file is named after the process, so instances sharing a checkpoint don't write over each other's
+    void Open(const char* file)
+    {
+        size_t length = strlen(file) + 16;
+        path = SDL_strdup(file);
+        temporary = (char*)malloc(length);
+        SDL_snprintf(temporary, length, "%s.%d", file, ProcessId());
+    }
+
+    // Takes over the malloc'ed bytes, only waits for the thread to take or drop the previous ones
+    void Submit(Uint8* bytes, int size)
+    {
+        if (thread == NULL && Start() == 0)
+        {
+            free(bytes);
+            return;
+        }
+        latest = (Uint8*)realloc(latest, size);
+        memcpy(latest, bytes, size);
+        SDL_LockMutex(lock);
+        free(pending);
+        pending = bytes;
+        pendingSize = size;
+        SDL_CondBroadcast(changed);
+        SDL_UnlockMutex(lock);
+    }
+
+    // The last checkpoint handed over while it is not in the file yet, NULL once it is
+    const Uint8* GetUnwritten()
+    {
+        if (thread == NULL)
+        {
+            return NULL;
+        }
+        SDL_LockMutex(lock);
+        int unwritten = pending != NULL || writing;
+        SDL_UnlockMutex(lock);
+        return unwritten ? latest : NULL;
+    }
+
+    void Close()
+    {
+        if (thread != NULL)
+        {
+            SDL_LockMutex(lock);
+            closing = 1;
+            SDL_CondBroadcast(changed);
+            SDL_UnlockMutex(lock);
+            SDL_WaitThread(thread, NULL);
+            thread = NULL;
+        }
+        SDL_DestroyCond(changed);
+        SDL_DestroyMutex(lock);
+        changed = NULL;
+        lock = NULL;
+        free(path);
+        free(temporary);
+        free(latest);
+        path = NULL;
+        temporary = NULL;
+        latest = NULL;
+    }
+
+    const char* GetPath() const { return path; }
+    int IsOpen() const { return path != NULL; }
+};
+
+// Lock-free triple buffer: the simulation fills the back slot and swaps it with the shared one,
+// the renderer swaps its front slot with the shared one whenever that holds a newer snapshot
+class SnapshotBuffer
+{
+private:
+    Snapshot slots[3];
+    SDL_atomic_t shared;    // Slot index, plus SNAPSHOT_FRESH while not taken by the renderer
+    int back;   // Simulation thread only
+    int front;  // Renderer thread only
+
+public:
+    SnapshotBuffer()
+    {
+        memset(slots, 0, sizeof(slots));
+        back = 0;
+        SDL_AtomicSet(&shared, 1);
+        front = 2;
+    }
+
+    ~SnapshotBuffer()
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            free(slots[i].body);
+            free(slots[i].previous);
+            free(slots[i].minimap);
+        }
+    }
+
+    Snapshot* GetBack()
+    {
+        return &slots[back];
+    }
+
+    // The back slot becomes the newest snapshot, writes to it are made visible first
+    void Publish()
+    {
+        SDL_MemoryBarrierRelease();
+        back = SDL_AtomicSet(&shared, back | SNAPSHOT_FRESH) & ~SNAPSHOT_FRESH;
+    }
+
+    // Take the newest snapshot if there is one, returns 1 if the front slot changed
+    int Acquire()
+    {
+        if ((SDL_AtomicGet(&shared) & SNAPSHOT_FRESH) == 0)
+        {
+            return 0;
+        }
+        front = SDL_AtomicSet(&shared, front) & ~SNAPSHOT_FRESH;
+        SDL_MemoryBarrierAcquire();
+        return 1;
+    }
+
+    const Snapshot* GetFront()
+    {
+        return &slots[front];
+    }
+};
+
+// Draws frames from snapshots, so it runs on whichever thread owns the renderer
+class SnapshotDrawer
+{
+private:
+    Segment* blended;   // Drawn positions, reused between frames
+    int blendedCapacity;
+    Camera camera;
+
+    // Segments <first, last> lie on a line, even segments counted from the head are the big ones.
+    // Cells outside the view are cut off, each one cut from the top-left end flips the phase.
+    void DrawRun(Renderer* renderer, int first, int last)
+    {
+        Segment* p = blended;
+        int topLeft = (p[first].x <= p[last].x && p[first].y <= p[last].y) ? first : last;
+        int columns = SDL_abs(p[last].x - p[first].x) / SEGMENT_SIZE + 1;
+        int rows = SDL_abs(p[last].y - p[first].y) / SEGMENT_SIZE + 1;
+        float column = CellColumn(p[topLeft].x), row = CellRow(p[topLeft].y);
+        int cutColumns = SDL_max(0, (int)SDL_floorf(camera.column - column));
+        int cutRows = SDL_max(0, (int)SDL_floorf(camera.row - row));
+        int endColumn = SDL_min(columns, (int)SDL_ceilf(camera.column + camera.columns - column));
+        int endRow = SDL_min(rows, (int)SDL_ceilf(camera.row + camera.rows - row));
+        if (cutColumns < endColumn && cutRows < endRow)
+        {
+            renderer->DrawRun(column + cutColumns, row + cutRows, endColumn - cutColumns, endRow - cutRows, (topLeft + cutColumns + cutRows) % 2, SNAKE_COLOR);
+        }
+    }
+
+    // Food & bonus outside the view are skipped
+    void DrawDot(Renderer* renderer, Segment segment, Uint32 color)
+    {
+        float column = CellColumn(segment.x), row = CellRow(segment.y);
+        if (column + 1 > camera.column && column < camera.column + camera.columns && row + 1 > camera.row && row < camera.row + camera.rows)
+        {
+            renderer->DrawDot(column, row, color);
+        }
+    }
+
+    // Start of the view along one axis: centered on the head and stopped by the board's edges,
+    // or centered on a board smaller than the view
+    float FollowAxis(float head, float view, int board)
+    {
+        float start = board <= view ? (board - view) / 2 : head - view / 2;
+        if (board > view)
+        {
+            start = start < 0 ? 0 : (start > board - view ? board - view : start);
+        }
+        return SDL_floorf(start * camera.cellSize) / camera.cellSize;   // Whole pixels, so shapes scroll together
+    }
+
+    void Follow(const Snapshot* snapshot)
+    {
+        camera.cellSize = SEGMENT_SIZE >> snapshot->zoom;
+        camera.columns = (float)BOARD_WIDTH / camera.cellSize;
+        camera.rows = (float)BOARD_HEIGHT / camera.cellSize;
+        camera.column = FollowAxis(CellColumn(blended[0].x) + 0.5f, camera.columns, snapshot->columns);
+        camera.row = FollowAxis(CellRow(blended[0].y) + 0.5f, camera.rows, snapshot->rows);
+    }
+
+    // Minimap pixel of a board cell
+    int MinimapX(const Snapshot* snapshot, int block, float column)
+    {
+        return MINIMAP_X + 1 + (int)(column * block / (1 << snapshot->minimapShift));
+    }
+
+    int MinimapY(const Snapshot* snapshot, int block, float row)
+    {
+        return MINIMAP_Y + 1 + (int)(row * block / (1 << snapshot->minimapShift));
+    }
+
+    // Occupied blocks merged along rows. Fills are inset by the outline's pixel, so solid blocks are given
+    // one more pixel on every side.
+    void DrawMinimapCells(Renderer* renderer, const Snapshot* snapshot, int block)
+    {
+        const Uint8* cells = snapshot->minimap;
+        for (int row = 0; row < snapshot->minimapRows; row++, cells += snapshot->minimapColumns)
+        {
+            for (int first = 0, last; first < snapshot->minimapColumns; first = last)
+            {
+                for (last = first + 1; cells[first] && last < snapshot->minimapColumns && cells[last]; last++)
+                {
+                }
+                if (cells[first])
+                {
+                    renderer->DrawBox(MINIMAP_X + first * block, MINIMAP_Y + row * block, (last - first) * block + 2, block + 2, NO_COLOR, SNAKE_COLOR);
+                }
+            }
+        }
+    }
+
+    // Downsampled board in the right margin with the view's outline and the food
+    void DrawMinimap(Renderer* renderer, const Snapshot* snapshot)
+    {
+        int block = MINIMAP_SIZE / SDL_max(snapshot->minimapColumns, snapshot->minimapRows);
+        renderer->DrawBox(MINIMAP_X, MINIMAP_Y, snapshot->minimapColumns * block + 2, snapshot->minimapRows * block + 2, OUTLINE_COLOR, NO_COLOR);
+        int x0 = MinimapX(snapshot, block, SDL_max(camera.column, 0)), y0 = MinimapY(snapshot, block, SDL_max(camera.row, 0));
+        int x1 = MinimapX(snapshot, block, SDL_min(camera.column + camera.columns, snapshot->columns));
+        int y1 = MinimapY(snapshot, block, SDL_min(camera.row + camera.rows, snapshot->rows));
+        renderer->DrawBox(x0, y0, x1 - x0, y1 - y0, OUTLINE_COLOR, NO_COLOR);
+        DrawMinimapCells(renderer, snapshot, block);
+
+        int food = MinimapX(snapshot, block, CellColumn(snapshot->food.x)), foodRow = MinimapY(snapshot, block, CellRow(snapshot->food.y));
+        renderer->DrawBox(food - 1, foodRow - 1, block + 2, block + 2, NO_COLOR, FOOD_COLOR);
+    }
+
+    // Played part of a watched replay, filled inside the outline. Nothing while playing.
+    void DrawScrubber(Renderer* renderer, const Snapshot* snapshot)
+    {
+        if (snapshot->replayTicks == 0)
+        {
+            return;
+        }
+        int played = (int)((Sint64)(BOARD_WIDTH - 2) * snapshot->replayTick / snapshot->replayTicks);
+        renderer->DrawBox(LEFT_EDGE, SCRUBBER_Y, BOARD_WIDTH, SCRUBBER_HEIGHT, OUTLINE_COLOR, NO_COLOR);
+        renderer->DrawBox(LEFT_EDGE, SCRUBBER_Y, played + 2, SCRUBBER_HEIGHT, NO_COLOR, OUTLINE_COLOR);
+    }
+
+    // Neighbours one segment apart along an axis can share a run
+    int Adjacent(Segment a, Segment b)
+    {
+        int dx = SDL_abs(b.x - a.x), dy = SDL_abs(b.y - a.y);
+        return (dx == SEGMENT_SIZE && dy == 0) || (dx == 0 && dy == SEGMENT_SIZE);
+    }
+
+    // Every segment is placed between its previous and current position, the buffer only grows with the snake
+    void Blend(const Snapshot* snapshot, float blend)
+    {
+        int length = snapshot->length;
+        if (length > blendedCapacity)
+        {
+            blendedCapacity = length * 2;
+            blended = (Segment*)realloc(blended, blendedCapacity * sizeof(Segment));
+        }
+        for (int i = 0; i < length; i++)
+        {
+            Segment from = snapshot->previous[i], to = snapshot->body[i];
+            blended[i].x = from.x + (int)((to.x - from.x) * blend);
+            blended[i].y = from.y + (int)((to.y - from.y) * blend);
+        }
+    }
+
+    // The blended body is walked once, consecutive segments moving the same way make one run
+    void DrawSnake(Renderer* renderer, const Snapshot* snapshot)
+    {
+        Segment* p = blended;
+        int length = snapshot->length;
+        int first = 0;
+        while (first < length)
+        {
+            int last = first;
+            if (first + 1 < length && Adjacent(p[first], p[first + 1]))
+            {
+                int dx = p[first + 1].x - p[first].x;
+                int dy = p[first + 1].y - p[first].y;
+                last = first + 1;
+                while (last + 1 < length && p[last + 1].x - p[last].x == dx && p[last + 1].y - p[last].y == dy)
+                {
+                    last++;
+                }
+            }
+            DrawRun(renderer, first, last);
+            first = last + 1;
+        }
+    }
+
+public:
+    SnapshotDrawer()
+    {
+        blended = NULL;
+        blendedCapacity = 0;
+    }
+
+    ~SnapshotDrawer()
+    {
+        free(blended);
+    }
+
+    // Board at the given time, which may be later than the snapshot when drawing on another thread
+    void DrawFrame(Renderer* renderer, const Snapshot* snapshot, Uint32 now, int interpolate)
+    {
+        float blend = interpolate ? (float)(now - snapshot->moveTime) / snapshot->moveInterval : 1.0f;   // From the previous body to the current one
+        double remaining = 1.0 - (float)(now - snapshot->bonusTime) / BONUS_DURATION; // Progress bar is shrinking to 0
+
+        Blend(snapshot, blend < 1.0f ? blend : 1.0f);  // Held once the next move is due
+        Follow(snapshot);
+
+        renderer->BeginFrame(FRAME_BOARD);
+        renderer->SetCamera(&camera);
+        renderer->DrawStatus(now - snapshot->startTime, snapshot->points);
+        DrawDot(renderer, snapshot->food, FOOD_COLOR);
+        if (snapshot->bonusActive)
+        {
+            DrawDot(renderer, snapshot->bonus, BONUS_COLOR);
+            renderer->DrawBar(remaining > 0 ? remaining : 0);
+        }
+        DrawSnake(renderer, snapshot);
+        if (snapshot->columns > BOARD_COLUMNS || snapshot->rows > BOARD_ROWS)   // Board larger than the view
+        {
+            DrawMinimap(renderer, snapshot);
+        }
+        DrawScrubber(renderer, snapshot);
+        renderer->EndFrame();
+    }
+
+    // "Best: 12  10  9" out of the board's leaderboard
+    static void FormatBest(char* out, const Snapshot* snapshot)
+    {
+        strcpy(out, "Best:");
+        for (int i = 0; i < snapshot->bestCount; i++)
+        {
+            strcat(out, "  ");
+            FormatUInt(out + strlen(out), snapshot->best[i]);
+        }
+    }
+
+    // Rendered once when the game ends, the screen stays as is until input arrives
+    void DrawGameOver(Renderer* renderer, const Snapshot* snapshot)
+    {
+        const char* gameOver = "Game Over!";
+        char score[32] = "Score: ";
+        FormatUInt(score + strlen(score), snapshot->points < 0 ? 0 : snapshot->points);
+        const char* hint = "Press 'Esc' to Quit or 'n' to Restart";
+        char best[16 + SCORE_SHOWN * 12];
+        FormatBest(best, snapshot);
+
+        renderer->BeginFrame(FRAME_MESSAGE);
+        renderer->DrawText(CenterTextX(gameOver, GAME_OVER_TEXT_SCALE), GAME_OVER_TEXT_Y - 50, gameOver, GAME_OVER_TEXT_SCALE);
+        renderer->DrawText(CenterTextX(score, GAME_OVER_TEXT_SCALE), GAME_OVER_TEXT_Y, score, GAME_OVER_TEXT_SCALE);
+        if (snapshot->bestCount > 0)
+        {
+            renderer->DrawText(CenterTextX(best, GAME_OVER_TEXT_SCALE), GAME_OVER_TEXT_Y + 50, best, GAME_OVER_TEXT_SCALE);
+        }
+        renderer->DrawText(CenterTextX(hint, GAME_OVER_TEXT_SCALE), GAME_OVER_TEXT_Y + 100, hint, GAME_OVER_TEXT_SCALE);
+        renderer->EndFrame();
+    }
+};
+
+// Info panel line: static labels go into the background layer, values are drawn glyph by glyph
+class InfoPanel
+{
+private:
+    const Font* font;
+    char timeText[INFO_FIELD_LENGTH];   // Values currently on the screen
+    char scoreText[INFO_FIELD_LENGTH];
+    char newTime[INFO_FIELD_LENGTH];    // Values to be drawn in the next frame
+    char newScore[INFO_FIELD_LENGTH];
+    int timeLength;
+    int scoreLength;
+    int timeX;  // Starting x-coordinates of the values
+    int scoreX;
+
+    static const char* TimeLabel() { return "'Esc' - Quit  |  'n' - Restart  |  Time: "; }
+    static const char* ScoreLabel() { return " s  |  Score: "; }
+    static const char* Requirements() { return "  |  Implemented Requirements: 1, 2, 3, 4, A, B, C, D"; }
+
+    int GlyphWidth()
+    {
+        return (int)(8 * INFO_PANEL_TEXT_SCALE);
+    }
+
+    // Redraw only the glyphs that differ from the value on the screen
+    void AddField(DrawList* list, char* rendered, const char* value, int x, int all)
+    {
+        for (int i = 0; value[i] != '\0'; i++)
+        {
+            if (all || rendered[i] != value[i])
+            {
+                SDL_Rect cell = { x + i * GlyphWidth(), INFO_PANEL_TEXT_Y, GlyphWidth(), GlyphWidth() };
+                list->AddRestore(&cell);
+                list->AddGlyph(cell.x, cell.y, value[i], font, INFO_PANEL_TEXT_SCALE);
+            }
+        }
+        strcpy(rendered, value);
+    }
+
+public:
+    void Initialize(const Font* charset)
+    {
+        font = charset;
+        timeLength = -1;    // Force the first layout
+        scoreLength = -1;
+    }
+
+    // Format new values, returns 1 if their lengths changed and the panel has to be laid out again
+    int Update(Uint32 elapsedTime, int points)
+    {
+        int newTimeLength = FormatSeconds(newTime, elapsedTime);
+        int newScoreLength = FormatUInt(newScore, points < 0 ? 0 : points);
+        if (newTimeLength == timeLength && newScoreLength == scoreLength)
+        {
+            return 0;
+        }
+
+        // Whole line is centered, so a value changing its length moves everything
+        int length = strlen(TimeLabel()) + newTimeLength + strlen(ScoreLabel()) + newScoreLength + strlen(Requirements());
+        timeX = (WINDOW_WIDTH - length * GlyphWidth()) / 2 + strlen(TimeLabel()) * GlyphWidth();
+        scoreX = timeX + (newTimeLength + strlen(ScoreLabel())) * GlyphWidth();
+        timeLength = newTimeLength;
+        scoreLength = newScoreLength;
+        return 1;
+    }
+
+    void DrawStatic(SDL_Surface* background)
+    {
+        int y = INFO_PANEL_TEXT_Y;
+        DrawString(background, timeX - strlen(TimeLabel()) * GlyphWidth(), y, TimeLabel(), font, INFO_PANEL_TEXT_SCALE);
+        DrawString(background, timeX + timeLength * GlyphWidth(), y, ScoreLabel(), font, INFO_PANEL_TEXT_SCALE);
+        DrawString(background, scoreX + scoreLength * GlyphWidth(), y, Requirements(), font, INFO_PANEL_TEXT_SCALE);
+        DrawRectangle(background, 0, INFO_PANEL_Y, WINDOW_WIDTH, INFO_PANEL_HEIGHT, OUTLINE_COLOR, BACKGROUND_COLOR);
+    }
+
+    // All glyphs are drawn after the screen has been restored as a whole
+    void AddValues(DrawList* list, int all)
+    {
+        AddField(list, timeText, newTime, timeX, all);
+        AddField(list, scoreText, newScore, scoreX, all);
+    }
+};
+
+// Draws nothing, for benchmarks and headless runs
+class NullRenderer : public Renderer
+{
+public:
+    int Initialize(SDL_Renderer*, Options) { return 1; }
+    int NeedsWindow() { return 0; }
+    void BeginFrame(FrameLayout) {}
+    void SetCamera(const Camera*) {}
+    void DrawCell(float, float, Uint32) {}
+    void DrawDot(float, float, Uint32) {}
+    void DrawRun(float, float, int, int, int, Uint32) {}
+    void DrawBar(double) {}
+    void DrawStatus(Uint32, int) {}
+    void DrawText(int, int, const char*, float) {}
+    void DrawBox(int, int, int, int, Uint32, Uint32) {}
+    void EndFrame() {}
+    void Refresh() {}
+};
+
+// Software rendering into an 8-bit indexed screen surface. Rows written in a frame are expanded
+// to 32-bit pixels straight into the streaming texture.
+class SurfaceRenderer : public Renderer
+{
+protected:
+    SDL_Renderer* target;
+    SDL_Surface* screen;
+    SDL_Texture* scrtex;
+    InfoPanel infoPanel;
+    BackgroundLayer layer;
+    DrawList drawList;
+    Rasterizer rasterizer;
+    PaletteExpander expander;
+    FrameLayout layout;
+    Camera camera;
+    SDL_Rect view;  // Inside of the board outline, board shapes are cut to it
+    int screenValid;    // Flag to check if the screen still holds the background layer
+    int runInset;       // Narrowing of small snake segments at full cell size, 0 = solid runs
+    Uint8 dirtyRows[WINDOW_HEIGHT];
+
+    void MarkRows(const SDL_Rect* rect)
+    {
+        for (int y = SDL_max(rect->y, 0); y < SDL_min(rect->y + rect->h, WINDOW_HEIGHT); y++)
+        {
+            dirtyRows[y] = 1;
+        }
+    }
+
+    void MarkListRows()
+    {
+        for (int i = 0; i < drawList.GetRestoreCount(); i++)
+        {
+            MarkRows(drawList.GetRestore(i));
+        }
+        for (int i = 0; i < drawList.GetCount(); i++)
+        {
+            MarkRows(&drawList.GetCommand(i)->bounds);
+        }
+    }
+
+    // Each run of consecutive dirty rows is locked and expanded in one go
+    void UploadRows()
+    {
+        int y = 0;
+        while (y < WINDOW_HEIGHT)
+        {
+            if (dirtyRows[y] == 0)
+            {
+                y++;
+                continue;
+            }
+            int end = y;
+            while (end < WINDOW_HEIGHT && dirtyRows[end])
+            {
+                dirtyRows[end++] = 0;
+            }
+            SDL_Rect rows = { 0, y, WINDOW_WIDTH, end - y };
+            void* pixels;
+            int pitch;
+            if (SDL_LockTexture(scrtex, &rows, &pixels, &pitch) == 0)
+            {
+                expander.Expand(screen, y, end - y, pixels, pitch);
+                SDL_UnlockTexture(scrtex);
+            }
+            y = end;
+        }
+    }
+
+    // Part of a board shape inside the view is restored in the next frame
+    void MarkBoard(int x, int y, int width, int height)
+    {
+        SDL_Rect shape = { x, y, width, height }, visible;
+        if (SDL_IntersectRect(&shape, &view, &visible))
+        {
+            layer.MarkDirty(visible.x, visible.y, visible.w, visible.h);
+        }
+    }
+
+    // Background, info panel labels & board outline never change between frames
+    void BuildBackground()
+    {
+        SDL_Surface* background = layer.GetSurface();
+        SDL_FillRect(background, NULL, MapColor(background, BACKGROUND_COLOR));
+        infoPanel.DrawStatic(background);
+        DrawRectangle(background, LEFT_EDGE, TOP_EDGE, BOARD_WIDTH, BOARD_HEIGHT, OUTLINE_COLOR, BACKGROUND_COLOR);
+    }
+
+    // Everything but the texture, for backends that never show the screen
+    int InitializeScreen(Options options)
+    {
+        runInset = options.snakeStyle == SNAKE_BEADS ? BEAD_INSET : 0;
+        camera = FullView();
+        SDL_Rect inside = { LEFT_EDGE + 1, TOP_EDGE + 1, BOARD_WIDTH - 2, BOARD_HEIGHT - 2 };
+        view = inside;
+        screen = CreateIndexedSurface(WINDOW_WIDTH, WINDOW_HEIGHT);
+        memset(dirtyRows, 1, sizeof(dirtyRows));
+        infoPanel.Initialize(&CHARSET);
+        if (layer.Initialize(1) == 0)
+        {
+            printf("SDL_CreateRGBSurface error: %s\n", SDL_GetError());
+            return 0;
+        }
+
+        if (rasterizer.Initialize(options.threads, options.threads > 1) == 0)
+        {
+            printf("SDL_CreateThread error: %s\n", SDL_GetError());
+            return 0;
+        }
+        screenValid = 0;
+        return 1;
+    }
+
+    // Frame is rasterized into the screen surface
+    void DrawScreen()
+    {
+        drawList.SetClip(NULL);
+        if (layout == FRAME_MESSAGE)
+        {
+            SDL_FillRect(screen, NULL, PaletteIndex(BACKGROUND_COLOR));
+            memset(dirtyRows, 1, sizeof(dirtyRows));
+            screenValid = 0;
+        }
+        else if (!screenValid)
+        {
+            BuildBackground();
+            SDL_Rect all = SurfaceBounds(screen);
+            drawList.AddRestore(&all);
+            infoPanel.AddValues(&drawList, 1);
+            screenValid = 1;
+        }
+        else
+        {
+            infoPanel.AddValues(&drawList, 0);
+        }
+        rasterizer.Execute(screen, layer.GetSurface(), &drawList);
+    }
+
+public:
+    SurfaceRenderer()
+    {
+        screen = NULL;
+        scrtex = NULL;
+    }
+
+    ~SurfaceRenderer()
+    {
+        SDL_FreeSurface(screen);
+        SDL_DestroyTexture(scrtex);
+    }
+
+    int Initialize(SDL_Renderer* target, Options options)
+    {
+        this->target = target;
+        scrtex = SDL_CreateTexture(target, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WINDOW_WIDTH, WINDOW_HEIGHT);
+        SDL_SetTextureBlendMode(scrtex, SDL_BLENDMODE_NONE);
+        expander.Initialize();
+        return InitializeScreen(options);
+    }
+
+    // Board frames start by restoring last frame's regions from the background layer
+    void BeginFrame(FrameLayout layout)
+    {
+        this->layout = layout;
+        drawList.Clear();
+        if (layout == FRAME_BOARD)
+        {
+            layer.TakeDirty(&drawList);
+        }
+    }
+
+    void SetCamera(const Camera* camera)
+    {
+        this->camera = *camera;
+    }
+
+    void DrawCell(float column, float row, Uint32 color)
+    {
+        int x = CellX(&camera, column), y = CellY(&camera, row), size = camera.cellSize;
+        drawList.SetClip(&view);
+        drawList.AddRectangle(x, y, size, size, NO_COLOR, color);
+        MarkBoard(x, y, size, size);
+    }
+
+    void DrawDot(float column, float row, Uint32 color)
+    {
+        int x = CellX(&camera, column), y = CellY(&camera, row), size = camera.cellSize;
+        drawList.SetClip(&view);
+        drawList.AddCircle(x + size / 2, y + size / 2, size / 2 - 1, color);
+        MarkBoard(x, y, size, size);
+    }
+
+    void DrawRun(float column, float row, int columns, int rows, int phase, Uint32 color)
+    {
+        int x = CellX(&camera, column), y = CellY(&camera, row), size = camera.cellSize;
+        drawList.SetClip(&view);
+        drawList.AddRun(x, y, columns * size, rows * size, phase, runInset * size / SEGMENT_SIZE, color);
+        MarkBoard(x, y, columns * size, rows * size);
+    }
+
+    void DrawBar(double remaining)
+    {
+        drawList.SetClip(NULL);
+        drawList.AddRectangle(PROGRESS_BAR_X, PROGRESS_BAR_Y, PROGRESS_BAR_WIDTH, PROGRESS_BAR_HEIGHT, OUTLINE_COLOR, NO_COLOR);
+        drawList.AddRectangle(PROGRESS_BAR_X, PROGRESS_BAR_Y, (int)(remaining * PROGRESS_BAR_WIDTH), PROGRESS_BAR_HEIGHT, NO_COLOR, BONUS_COLOR);
+        layer.MarkDirty(PROGRESS_BAR_X, PROGRESS_BAR_Y, PROGRESS_BAR_WIDTH, PROGRESS_BAR_HEIGHT);
+    }
+
+    // The layer is rebuilt when the panel layout changes
+    void DrawStatus(Uint32 elapsedTime, int points)
+    {
+        if (infoPanel.Update(elapsedTime, points))
+        {
+            screenValid = 0;
+        }
+    }
+
+    void DrawText(int x, int y, const char* text, float scale)
+    {
+        drawList.SetClip(NULL);
+        drawList.AddText(x, y, text, &CHARSET, scale);
+    }
+
+    void DrawBox(int x, int y, int width, int height, Uint32 outlineColor, Uint32 fillColor)
+    {
+        drawList.SetClip(NULL);
+        drawList.AddRectangle(x, y, width, height, outlineColor, fillColor);
+        layer.MarkDirty(x, y, width, height);
+    }
+
+    void EndFrame()
+    {
+        DrawScreen();
+        MarkListRows();
+        UploadRows();
+        Refresh();
+    }
+
+    // The texture keeps the last frame
+    void Refresh()
+    {
+        SDL_RenderCopy(target, scrtex, NULL, NULL);
+    }
+};
+
+// Board cells go to the grid texture, the surface keeps the info panel and the progress bar.
+// Food and bonus are drawn as whole cells.
+class GridRenderer : public SurfaceRenderer
+{
+private:
+    CellGrid grid;
+
+public:
+    int Initialize(SDL_Renderer* target, Options options)
+    {
+        if (SurfaceRenderer::Initialize(target, options) == 0)
+        {
+            return 0;
+        }
+        if (grid.Initialize(target, options.boardColumns, options.boardRows) == 0)
+        {
+            printf("SDL_CreateTexture error: %s\n", SDL_GetError());
+            return 0;
+        }
+        return 1;
+    }
+
+    void BeginFrame(FrameLayout layout)
+    {
+        SurfaceRenderer::BeginFrame(layout);
+        grid.Begin();
+    }
+
+    void DrawCell(float column, float row, Uint32 color)
+    {
+        grid.SetCell((int)SDL_floorf(column + 0.5f), (int)SDL_floorf(row + 0.5f), color);
+    }
+
+    void DrawDot(float column, float row, Uint32 color)
+    {
+        DrawCell(column, row, color);
+    }
+
+    // Cells of the grid are whole, the phase of the run makes no difference
+    void DrawRun(float column, float row, int columns, int rows, int, Uint32 color)
+    {
+        for (int i = 0; i < columns * rows; i++)
+        {
+            DrawCell(column + i % columns, row + i / columns, color);
+        }
+    }
+
+    void EndFrame()
+    {
+        grid.Upload();
+        SurfaceRenderer::EndFrame();
+    }
+
+    void Refresh()
+    {
+        SurfaceRenderer::Refresh();
+        if (layout == FRAME_BOARD)
+        {
+            // Whole cells covering the view are stretched to the camera's cell size and cut to the view,
+            // the board outline is drawn over them
+            SDL_Rect board = { LEFT_EDGE, TOP_EDGE, BOARD_WIDTH, BOARD_HEIGHT };
+            SDL_Rect cells = { (int)SDL_floorf(camera.column), (int)SDL_floorf(camera.row), (int)SDL_ceilf(camera.columns) + 1, (int)SDL_ceilf(camera.rows) + 1 };
+            grid.ClipCells(&cells);
+            SDL_Rect stretched = { CellX(&camera, (float)cells.x), CellY(&camera, (float)cells.y), cells.w * camera.cellSize, cells.h * camera.cellSize };
+            SDL_RenderSetClipRect(target, &board);
+            grid.Draw(target, &cells, &stretched);
+            SDL_RenderSetClipRect(target, NULL);
+            SDL_SetRenderDrawColor(target, (OUTLINE_COLOR >> 16) & 0xFF, (OUTLINE_COLOR >> 8) & 0xFF, OUTLINE_COLOR & 0xFF, 255);
+            SDL_RenderDrawRect(target, &board);
+        }
+    }
+};
+
+// Board shapes and the progress bar are submitted as batched rectangles on top of the screen texture
+class RectRenderer : public SurfaceRenderer
+{
+private:
+    RectBatch batch;
+
+public:
+    void BeginFrame(FrameLayout layout)
+    {
+        SurfaceRenderer::BeginFrame(layout);
+        batch.Clear();
+    }
+
+    void DrawCell(float column, float row, Uint32 color)
+    {
+        batch.SetClip(&view);
+        batch.AddRectangle(CellX(&camera, column), CellY(&camera, row), camera.cellSize, camera.cellSize, NO_COLOR, color);
+    }
+
+    void DrawDot(float column, float row, Uint32 color)
+    {
+        int size = camera.cellSize;
+        batch.SetClip(&view);
+        batch.AddCircle(CellX(&camera, column) + size / 2, CellY(&camera, row) + size / 2, size / 2 - 1, color);
+    }
+
+    // Same pixels as DrawRunClipped: the narrow body over the whole run plus every other big segment
+    void DrawRun(float column, float row, int columns, int rows, int phase, Uint32 color)
+    {
+        int x = CellX(&camera, column), y = CellY(&camera, row), size = camera.cellSize;
+        int inset = runInset * size / SEGMENT_SIZE;
+        int insetX = columns > rows ? 0 : inset, insetY = columns > rows ? inset : 0;
+        batch.SetClip(&view);
+        batch.AddRectangle(x + insetX, y + insetY, columns * size - 2 * insetX, rows * size - 2 * insetY, NO_COLOR, color);
+        for (int i = phase; i < columns * rows && inset > 0; i += 2)
+        {
+            batch.AddRectangle(x + (i % columns) * size, y + (i / columns) * size, size, size, NO_COLOR, color);
+        }
+    }
+
+    void DrawBox(int x, int y, int width, int height, Uint32 outlineColor, Uint32 fillColor)
+    {
+        batch.SetClip(NULL);
+        batch.AddRectangle(x, y, width, height, outlineColor, fillColor);
+    }
+
+    void DrawBar(double remaining)
+    {
+        batch.SetClip(NULL);
+        batch.AddRectangle(PROGRESS_BAR_X, PROGRESS_BAR_Y, PROGRESS_BAR_WIDTH, PROGRESS_BAR_HEIGHT, OUTLINE_COLOR, NO_COLOR);
+        batch.AddRectangle(PROGRESS_BAR_X, PROGRESS_BAR_Y, (int)(remaining * PROGRESS_BAR_WIDTH), PROGRESS_BAR_HEIGHT, NO_COLOR, BONUS_COLOR);
+    }
+
+    void Refresh()
+    {
+        SurfaceRenderer::Refresh();
+        if (layout == FRAME_BOARD)
+        {
+            batch.Submit(target);
+        }
+    }
+};
+
+// ANSI terminal output for headless machines & SSH sessions. A character shows two board cells as an upper
+// half block, the top cell in its foreground color and the bottom one in its background. Only characters
+// that differ from the last frame are sent, with the cursor moves & color changes they need, in one write.
+class TerminalRenderer : public Renderer
+{
+private:
+    Camera camera;
+    FrameLayout layout;
+    int columns;    // View in cells
+    int rows;
+    int lines;      // Character rows of the board, the last one holds a single cell row if rows are odd
+    Uint8* cells;   // Color of each cell of the view, two cell rows per line
+    Uint8* shown;   // Characters on the terminal, top color | bottom color << 4, 0xFF = unknown
+    int capacity;   // Characters both arrays have room for
+    int valid;      // Flag to check if the terminal still shows the board
+    double bar;     // Remaining bonus time, negative without a bonus
+    char status[TERMINAL_LINE_LENGTH];  // Line above the board
+    char shownStatus[TERMINAL_LINE_LENGTH];
+    char message[TERMINAL_MESSAGE_LINES][TERMINAL_LINE_LENGTH];
+    int messageLines;
+    char* out;      // Everything sent in the frame
+    int outLength;
+    int outCapacity;
+    int cursorX;    // -1 = unknown
+    int cursorY;
+    int foreground; // -1 = the terminal's own colors
+    int background;
+
+    // Standard 8 colors: red, green & blue are bits 0, 1 & 2
+    static int AnsiColor(Uint32 color)
+    {
+        return ((color >> 23) & 1) | ((color >> 14) & 2) | ((color >> 5) & 4);
+    }
+
+    void Append(const char* text, int length)
+    {
+        if (outLength + length > outCapacity)
+        {
+            outCapacity = (outLength + length) * 2;
+            out = (char*)realloc(out, outCapacity);
+        }
+        memcpy(out + outLength, text, length);
+        outLength += length;
+    }
+
+    void AppendNumber(int value)
+    {
+        char digits[16];
+        Append(digits, FormatUInt(digits, value));
+    }
+
+    // One column wide character, UTF-8 encoded
+    void Put(const char* character)
+    {
+        Append(character, strlen(character));
+        cursorX++;
+    }
+
+    // Character position counted from 0, nothing is sent if the cursor is already there
+    void MoveTo(int x, int y)
+    {
+        if (x != cursorX || y != cursorY)
+        {
+            Append("\x1b[", 2);
+            AppendNumber(y + 1);
+            Append(";", 1);
+            AppendNumber(x + 1);
+            Append("H", 1);
+            cursorX = x;
+            cursorY = y;
+        }
+    }
+
+    // -1 switches back to the terminal's own colors
+    void SetColors(int fg, int bg)
+    {
+        if (fg == foreground && bg == background)
+        {
+            return;
+        }
+        if (fg < 0)
+        {
+            Append("\x1b[0m", 4);
+        }
+        else
+        {
+            Append("\x1b[3", 3);
+            AppendNumber(fg);
+            Append(";4", 2);
+            AppendNumber(bg);
+            Append("m", 1);
+        }
+        foreground = fg;
+        background = bg;
+    }
+
+    // Line of the outline: a corner, the edge above or below the view and another corner
+    void PutEdge(int y, const char* left, const char* right)
+    {
+        MoveTo(0, y);
+        Put(left);
+        for (int x = 0; x < columns; x++)
+        {
+            Put("\xE2\x94\x80");
+        }
+        Put(right);
+    }
+
+    // Hidden cursor & an empty screen with the board outline, every character is unknown afterwards
+    void Repaint()
+    {
+        SetColors(-1, -1);
+        Append("\x1b[?25l\x1b[2J", 10);
+        cursorX = cursorY = -1;
+        PutEdge(1, "\xE2\x94\x8C", "\xE2\x94\x90");
+        for (int y = 0; y < lines; y++)
+        {
+            MoveTo(0, y + 2);
+            Put("\xE2\x94\x82");
+            MoveTo(columns + 1, y + 2);
+            Put("\xE2\x94\x82");
+        }
+        PutEdge(lines + 2, "\xE2\x94\x94", "\xE2\x94\x98");
+        memset(shown, 0xFF, capacity);
+        shownStatus[0] = '\0';
+        valid = 1;
+    }
+
+    // Board cells seen through the camera, positions are rounded to whole cells
+    void Fill(float column, float row, int width, int height, Uint32 color)
+    {
+        int x0 = (int)SDL_floorf(column - camera.column + 0.5f);
+        int y0 = (int)SDL_floorf(row - camera.row + 0.5f);
+        int x1 = SDL_min(x0 + width, columns);
+        int y1 = SDL_min(y0 + height, rows);
+        for (int y = SDL_max(y0, 0); y < y1; y++)
+        {
+            for (int x = SDL_max(x0, 0); x < x1; x++)
+            {
+                cells[y * columns + x] = (Uint8)AnsiColor(color);
+            }
+        }
+    }
+
+    // The view follows the zoom, a new size starts over with an empty screen
+    void Resize(int viewColumns, int viewRows)
+    {
+        if (viewColumns == columns && viewRows == rows)
+        {
+            return;
+        }
+        columns = viewColumns;
+        rows = viewRows;
+        lines = (rows + 1) / 2;
+        if (columns * lines > capacity)
+        {
+            capacity = columns * lines;
+            cells = (Uint8*)realloc(cells, 2 * capacity);
+            shown = (Uint8*)realloc(shown, capacity);
+        }
+        valid = 0;
+    }
+
+    // Characters whose pair of cells changed
+    void WriteCells()
+    {
+        for (int y = 0; y < lines; y++)
+        {
+            const Uint8* top = cells + 2 * y * columns;
+            for (int x = 0; x < columns; x++)
+            {
+                Uint8 pair = (Uint8)(top[x] | top[x + columns] << 4);
+                if (shown[y * columns + x] != pair)
+                {
+                    MoveTo(x + 1, y + 2);
+                    SetColors(top[x], top[x + columns]);
+                    Put("\xE2\x96\x80");
+                    shown[y * columns + x] = pair;
+                }
+            }
+        }
+    }
+
+    // Bonus bar is appended to the time & score, then only the characters that changed are sent
+    void WriteStatus()
+    {
+        int length = strlen(status);
+        if (bar >= 0)
+        {
+            length += strlen(strcpy(status + length, " | Bonus: "));
+            for (int i = 0; i < TERMINAL_BAR_WIDTH; i++)
+            {
+                status[length++] = i < bar * TERMINAL_BAR_WIDTH ? '#' : ' ';
+            }
+            status[length] = '\0';
+        }
+
+        int shownLength = strlen(shownStatus);
+        SetColors(-1, -1);
+        for (int i = 0; i < length; i++)
+        {
+            if (i >= shownLength || status[i] != shownStatus[i])
+            {
+                MoveTo(i, 0);
+                Append(status + i, 1);
+                cursorX++;
+            }
+        }
+        if (length < shownLength)
+        {
+            MoveTo(length, 0);
+            Append("\x1b[K", 3);    // Rest of the old line
+        }
+        strcpy(shownStatus, status);
+    }
+
+    // Lines of text centered on an empty screen, the board is repainted by the next board frame
+    void WriteMessage()
+    {
+        SetColors(-1, -1);
+        Append("\x1b[?25l\x1b[2J", 10);
+        cursorX = cursorY = -1;
+        for (int i = 0; i < messageLines; i++)
+        {
+            int length = strlen(message[i]);
+            MoveTo(SDL_max((columns + 2 - length) / 2, 0), (lines + 3) / 2 - messageLines + 1 + 2 * i);
+            Append(message[i], length);
+            cursorX += length;
+        }
+        valid = 0;
+    }
+
+    // The whole frame in a single write, the cursor is left below the board for anything else printed
+    void Flush()
+    {
+        if (outLength > 0)
+        {
+            MoveTo(0, lines + 3);
+            fwrite(out, 1, outLength, stdout);
+            fflush(stdout);
+            outLength = 0;
+        }
+    }
+
+public:
+    TerminalRenderer()
+    {
+        columns = rows = lines = 0;
+        cells = shown = NULL;
+        capacity = 0;
+        valid = 0;
+        out = NULL;
+        outLength = outCapacity = 0;
+        cursorX = cursorY = -1;
+        foreground = background = -1;
+    }
+
+    // Terminal gets its colors & cursor back
+    ~TerminalRenderer()
+    {
+        if (capacity > 0)
+        {
+            SetColors(-1, -1);
+            Append("\x1b[?25h", 6);
+            Flush();
+        }
+        free(cells);
+        free(shown);
+        free(out);
+    }
+
+    int Initialize(SDL_Renderer*, Options)
+    {
+        camera = FullView();
+        return 1;
+    }
+
+    int NeedsWindow() { return 0; }
+
+    void BeginFrame(FrameLayout layout)
+    {
+        this->layout = layout;
+        bar = -1;
+        status[0] = '\0';
+        messageLines = 0;
+    }
+
+    // Called once per board frame, which starts from an empty view
+    void SetCamera(const Camera* camera)
+    {
+        this->camera = *camera;
+        Resize((int)SDL_ceilf(camera->columns), (int)SDL_ceilf(camera->rows));
+        memset(cells, AnsiColor(BACKGROUND_COLOR), 2 * columns * lines);
+    }
+
+    void DrawCell(float column, float row, Uint32 color)
+    {
+        Fill(column, row, 1, 1, color);
+    }
+
+    void DrawDot(float column, float row, Uint32 color)
+    {
+        Fill(column, row, 1, 1, color);
+    }
+
+    // Segments fill whole cells, so the phase makes no difference
+    void DrawRun(float column, float row, int columns, int rows, int, Uint32 color)
+    {
+        Fill(column, row, columns, rows, color);
+    }
+
+    void DrawBar(double remaining)
+    {
+        bar = remaining;
+    }
+
+    void DrawStatus(Uint32 elapsedTime, int points)
+    {
+        char* p = status + strlen(strcpy(status, "Time: "));
+        p += FormatSeconds(p, elapsedTime);
+        p += strlen(strcpy(p, " s | Score: "));
+        FormatUInt(p, points < 0 ? 0 : points);
+    }
+
+    // Lines are stacked in the order they are drawn, their positions in window pixels don't apply
+    void DrawText(int, int, const char* text, float)
+    {
+        if (messageLines < TERMINAL_MESSAGE_LINES)
+        {
+            SDL_strlcpy(message[messageLines++], text, TERMINAL_LINE_LENGTH);
+        }
+    }
+
+    // Window pixel boxes, like the minimap, have no place on the terminal
+    void DrawBox(int, int, int, int, Uint32, Uint32) {}
+
+    void EndFrame()
+    {
+        if (layout == FRAME_MESSAGE)
+        {
+            WriteMessage();
+        }
+        else
+        {
+            if (!valid)
+            {
+                Repaint();
+            }
+            WriteCells();
+            WriteStatus();
+        }
+        Flush();
+    }
+
+    // Last frame is sent again in full
+    void Refresh()
+    {
+        valid = 0;
+        EndFrame();
+    }
+};
+
+// Draws like the surface renderer without a window, every frame is handed to the capture writer
+class CaptureRenderer : public SurfaceRenderer
+{
+private:
+    CaptureWriter writer;
+
+public:
+    int Initialize(SDL_Renderer*, Options options)
+    {
+        return InitializeScreen(options) && writer.Open(options.capturePath, WINDOW_WIDTH, WINDOW_HEIGHT, CaptureFps(options));
+    }
+
+    int NeedsWindow() { return 0; }
+
+    void EndFrame()
+    {
+        DrawScreen();
+        Uint8* frame = writer.Acquire();
+        for (int y = 0; y < screen->h; y++)
+        {
+            memcpy(frame + y * screen->w, (Uint8*)screen->pixels + y * screen->pitch, screen->w);
+        }
+        writer.Submit();
+    }
+
+    void Refresh() {}
+};
+
+Renderer* CreateRenderer(RenderMode mode)
+{
+    switch (mode)
+    {
+        case RENDER_NULL:
+            return new NullRenderer();
+        case RENDER_GRID:
+            return new GridRenderer();
+        case RENDER_RECTS:
+            return new RectRenderer();
+        case RENDER_TERMINAL:
+            return new TerminalRenderer();
+        case RENDER_CAPTURE:
+            return new CaptureRenderer();
+        default:
+            return new SurfaceRenderer();
+    }
+}
+
+class Game
+{
+private:
+    SDL_Window* window;
+    SDL_Renderer* renderer;
+	SDL_Event event;
+    Simulation simulation;
+    InputLog inputs;    // Turns of the current game
+    KeyframeLog keyframes;  // Of the current game while recording
+    Replayer replayer;  // Watched game
+    ArchiveWriter archive;  // Closed when not archiving
+    ScoreBoard scores;  // Closed when scores are not kept
+    CheckpointWriter checkpoints;   // Closed without a checkpoint file
+    Telemetry telemetry;    // Closed unless events are streamed
+    int scored;         // Set once the current game is in the score log
+    int bestCount;      // Leaderboard of the board after the last game ended
+    int best[SCORE_SHOWN];
+    Renderer* backend;
+    FrameScheduler scheduler;
+    SnapshotBuffer snapshots;
+    SnapshotDrawer drawer;
+    SDL_Thread* renderThread;   // NULL when drawing on the main thread
+    SDL_sem* wake;  // Posted when the render thread has something to do on the Game Over screen
+    SDL_atomic_t stopRendering;
+    SDL_atomic_t refreshRequested;
+    int renderReady;    // Set by the render thread before it signals it is ready
+    Options options;
+    FILE* recordFile;   // NULL when not recording
+    Uint32 seed;        // Of the current game
+    int recorded;       // Set once the current game is in the recording
+    int watching;       // A recorded game plays instead of a new one
+    int paused;         // Watching only, the game clock stands still
+    int scrubbing;      // The scrubber is being dragged
+    Uint32 clockOffset; // Game time is SDL_GetTicks() minus this
+    Uint32 pauseTime;   // Game time while paused
+    int zoom;   // Cell size is SEGMENT_SIZE >> zoom
+    Uint32 captureTime; // Game time while capturing
+    int quit;           // Flag to check if the game should end
+	int initialized;    // Flag to check if initialization was successful
+    int frames;
+    int steps;
+    Uint64 simulationTicks; // Performance counter ticks spent in simulation steps, including publishing snapshots
+    Uint64 renderTicks; // Ticks spent drawing frames, excluding presents
+    Uint64 sdlReady;    // Performance counters of startup milestones, 0 = not reached yet
+    Uint64 firstTick;
+    Uint64 firstFrame;
+
+    // The last frame is copied again by whichever thread owns the renderer
+    void RefreshScreen()
+    {
+        if (renderThread != NULL)
+        {
+            SDL_AtomicSet(&refreshRequested, 1);
+            WakeRenderer();
+            return;
+        }
+        backend->Refresh();
+        Present();
+    }
+
+    void HandleKey(SDL_Keycode key)
+    {
+        if (watching && HandleWatchKey(key))
+        {
+            return;
+        }
+        switch (key)
+        {
+            case SDLK_ESCAPE:
+                quit = 1;
+                break;
+            case SDLK_n:
+                NewGame();
+                break;
+            case SDLK_s:
+                SaveCheckpoint();
+                break;
+            case SDLK_l:
+                LoadCheckpoint();
+                break;
+            case SDLK_UP:
+                Steer(UP);
+                break;
+            case SDLK_DOWN:
+                Steer(DOWN);
+                break;
+            case SDLK_LEFT:
+                Steer(LEFT);
+                break;
+            case SDLK_RIGHT:
+                Steer(RIGHT);
+                break;
+            case SDLK_EQUALS:
+            case SDLK_KP_PLUS:
+                zoom = SDL_max(zoom - 1, 0);
+                break;
+            case SDLK_MINUS:
+            case SDLK_KP_MINUS:
+                ZoomOut();
+                break;
+        }
+    }
+
+    // While watching the arrows scrub instead of steering, space pauses
+    int HandleWatchKey(SDL_Keycode key)
+    {
+        switch (key)
+        {
+            case SDLK_SPACE:
+                TogglePause();
+                return 1;
+            case SDLK_LEFT:
+                SeekTo(simulation.GetTick() - REPLAY_SEEK_TICKS);
+                return 1;
+            case SDLK_RIGHT:
+                SeekTo(simulation.GetTick() + REPLAY_SEEK_TICKS);
+                return 1;
+            case SDLK_HOME:
+                SeekTo(0);
+                return 1;
+            case SDLK_END:
+                SeekTo(replayer.GetHeader()->ticks);
+                return 1;
+            case SDLK_UP:
+            case SDLK_DOWN:
+                return 1;
+        }
+        return 0;
+    }
+
+    // Pressing the button on the scrubber seeks to the tick under the pointer, dragging keeps seeking until it is released
+    void Scrub(const SDL_Event* event)
+    {
+        if (event->type == SDL_MOUSEBUTTONDOWN)
+        {
+            scrubbing = event->button.button == SDL_BUTTON_LEFT && event->button.x >= LEFT_EDGE && event->button.x < RIGHT_EDGE &&
+                SDL_abs(event->button.y - (SCRUBBER_Y + SCRUBBER_HEIGHT / 2)) <= SCRUBBER_HEIGHT / 2 + SCRUBBER_MARGIN;
+        }
+        else if (event->type == SDL_MOUSEBUTTONUP)
+        {
+            scrubbing = 0;
+        }
+        if (scrubbing)
+        {
+            int x = event->type == SDL_MOUSEMOTION ? event->motion.x : event->button.x;
+            SeekTo((int)((Sint64)(x - LEFT_EDGE) * replayer.GetHeader()->ticks / BOARD_WIDTH));
+        }
+    }
+
+    // Game time continues from the tick the watched game is moved to
+    void SeekTo(int tick)
+    {
+        replayer.Seek(&simulation, SDL_max(0, SDL_min(tick, replayer.GetHeader()->ticks)));
+        SetClock(simulation.GetTime());
+    }
+
+    // The clock is set to where it stands, running or not, before switching
+    void TogglePause()
+    {
+        SetClock(Now());
+        paused = !paused;
+    }
+
+    // Zooming out stops once the whole board fits the view
+    void ZoomOut()
+    {
+        int cellSize = SEGMENT_SIZE >> zoom;
+        if (zoom + 1 < ZOOM_LEVELS && (options.boardColumns * cellSize > BOARD_WIDTH || options.boardRows * cellSize > BOARD_HEIGHT))
+        {
+            zoom++;
+        }
+    }
+
+    // Only turns the snake takes are recorded, at the tick they come before
+    void Steer(Direction direction)
+    {
+        if (simulation.Steer(direction))
+        {
+            inputs.Add(simulation.GetTick(), direction);
+        }
+    }
+
+    // The game as it stands goes to the checkpoint writer, the frame loop never waits for the disk
+    void SaveCheckpoint()
+    {
+        if (checkpoints.IsOpen() == 0 || watching || simulation.GetState() != PLAYING)
+        {
+            return;
+        }
+        Uint8* bytes = (Uint8*)malloc(sizeof(CheckpointHeader) + simulation.SaveBound());
+        CheckpointHeader* header = (CheckpointHeader*)bytes;
+        memcpy(header->magic, CHECKPOINT_MAGIC, 4);
+        header->version = CHECKPOINT_VERSION;
+        header->columns = options.boardColumns;
+        header->rows = options.boardRows;
+        header->size = simulation.Save((Uint8*)(header + 1));
+        header->checksum = Checksum(header + 1, header->size);
+        checkpoints.Submit(bytes, sizeof(CheckpointHeader) + header->size);
+    }
+
+    // A save not in the file yet is loaded from memory, so the frame loop never waits for the writer. The checked
+    // checkpoint replaces the game, which goes on from its own time. The loaded game isn't recorded, a replay has to
+    // start from the seed.
+    void LoadCheckpoint()
+    {
+        if (checkpoints.IsOpen() == 0 || watching)
+        {
+            return;
+        }
+        const CheckpointHeader* unwritten = (const CheckpointHeader*)checkpoints.GetUnwritten();
+        CheckpointHeader* read = unwritten == NULL ? ReadCheckpoint(checkpoints.GetPath()) : NULL;
+        const CheckpointHeader* header = unwritten != NULL ? unwritten : read;
+        if (header == NULL || header->columns != (Uint32)options.boardColumns || header->rows != (Uint32)options.boardRows)
+        {
+            printf(header == NULL ? "No valid checkpoint in %s\n" : "Checkpoint %s is of another board\n", checkpoints.GetPath());
+            free(read);
+            return;
+        }
+        SaveRecording();
+        const Uint8* next = (const Uint8*)(header + 1);
+        int loaded = simulation.Load(&next, next + header->size, options.boardColumns, options.boardRows, Now());
+        free(read);
+        if (loaded == 0)
+        {
+            NewGame();
+            return;
+        }
+        SetClock(simulation.GetTime());
+        inputs.Clear();
+        keyframes.Clear();
+        recorded = 1;
+        scored = 0;
+    }
+
+    // Input of both states, the Game Over screen is also redrawn when exposed
+    void HandleEvent(const SDL_Event* event)
+    {
+        if (event->type == SDL_QUIT)
+        {
+            quit = 1;
+        }
+        else if (event->type == SDL_KEYDOWN)
+        {
+            HandleKey(event->key.keysym.sym);
+        }
+        else if (watching && (event->type == SDL_MOUSEBUTTONDOWN || event->type == SDL_MOUSEBUTTONUP || event->type == SDL_MOUSEMOTION))
+        {
+            Scrub(event);
+        }
+        else if (event->type == SDL_WINDOWEVENT && simulation.GetState() == GAME_OVER &&
+            (event->window.event == SDL_WINDOWEVENT_EXPOSED || event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED))
+        {
+            RefreshScreen();
+        }
+    }
+
+    void HandleControls()
+    {
+        while (SDL_PollEvent(&event))
+        {
+            HandleEvent(&event);
+        }
+    }
+
+    // Steps that are due by now. A watched game pauses at its last recorded tick, a recorded one gets a keyframe
+    // every REPLAY_KEYFRAME_INTERVAL ticks and goes to the recording when it ends.
+    void Advance()
+    {
+        Mark(&firstTick);
+        while (simulation.GetState() == PLAYING && paused == 0 && (Sint32)(simulation.NextTickTime() - Now()) <= 0)
+        {
+            if (watching && simulation.GetTick() == replayer.GetHeader()->ticks)
+            {
+                TogglePause();
+                break;
+            }
+            watching ? replayer.Step(&simulation) : simulation.Step();
+            steps++;
+            if (IsRecording() && simulation.GetTick() % REPLAY_KEYFRAME_INTERVAL == 0)
+            {
+                keyframes.Add(&simulation, &inputs);
+            }
+        }
+        if (simulation.GetState() == GAME_OVER)
+        {
+            SaveRecording();
+            SaveScore();
+        }
+    }
+
+    int IsRecording()
+    {
+        return recordFile != NULL || archive.IsOpen();
+    }
+
+    // Appends the current game to the recording once, when it ends or is abandoned
+    void SaveRecording()
+    {
+        if (IsRecording() == 0 || recorded || simulation.GetTick() == 0)
+        {
+            return;
+        }
+        ReplayHeader header = { options.boardColumns, options.boardRows, seed, simulation.GetTick(), simulation.GetPoints(), inputs.GetLength(),
+            REPLAY_KEYFRAME_INTERVAL, keyframes.GetLength() };
+        if (recordFile != NULL && WriteReplay(recordFile, &header, inputs.GetBytes(), keyframes.GetBytes()) == 0)
+        {
+            printf("Can't write to replay file %s\n", options.recordPath);
+        }
+        if (archive.IsOpen() && archive.Append(&header, &simulation, inputs.GetBytes(), keyframes.GetBytes()) == 0)
+        {
+            printf("Can't append to archive %s\n", options.archivePath);
+        }
+        recorded = 1;
+    }
+
+    // A finished game goes to the score log, then the board's best scores are looked up for the Game Over screen
+    void SaveScore()
+    {
+        if (scored || scores.IsOpen() == 0)
+        {
+            return;
+        }
+        scored = 1;
+        if (scores.Add(options.boardColumns, options.boardRows, simulation.GetPoints(), simulation.GetTick(), simulation.GetElapsedTime(), seed) == 0)
+        {
+            printf("Can't write to score log %s\n", options.scoresPath);
+        }
+        const ScoreTable* table = scores.Top(options.boardColumns, options.boardRows);
+        bestCount = table != NULL ? SDL_min((int)table->count, SCORE_SHOWN) : 0;
+        for (int i = 0; i < bestCount; i++)
+        {
+            best[i] = table->best[i].points;
+        }
+    }
+
+    // Copy of the current state for the renderer, the newest one replaces any not drawn yet
+    void Publish()
+    {
+        Snapshot* snapshot = snapshots.GetBack();
+        simulation.Capture(snapshot);
+        snapshot->zoom = zoom;
+        snapshot->replayTick = simulation.GetTick();
+        snapshot->replayTicks = watching ? replayer.GetHeader()->ticks : 0;
+        snapshot->bestCount = bestCount;
+        memcpy(snapshot->best, best, sizeof(best));
+        snapshot->paused = paused;
+        snapshot->pauseTime = pauseTime;
+        snapshot->clockOffset = clockOffset;
+        snapshots.Publish();
+        WakeRenderer();
+    }
+
+    // Only matters while the render thread sleeps on the Game Over screen, posts never pile up
+    void WakeRenderer()
+    {
+        if (renderThread != NULL && SDL_SemValue(wake) == 0)
+        {
+            SDL_SemPost(wake);
+        }
+    }
+
+    void Present()
+    {
+        Mark(&firstFrame);
+        if (renderer != NULL)
+        {
+            scheduler.Present(renderer);
+        }
+    }
+
+    // Game time runs on the wall clock shifted by seeks & pauses, or from frame to frame when capturing faster than real time
+    Uint32 Now()
+    {
+        if (options.capturePath != NULL)
+        {
+            return captureTime;
+        }
+        return paused ? pauseTime : SDL_GetTicks() - clockOffset;
+    }
+
+    // Game time on the clock published with the snapshot, read by the render thread
+    static Uint32 ClockOf(const Snapshot* snapshot)
+    {
+        return snapshot->paused ? snapshot->pauseTime : SDL_GetTicks() - snapshot->clockOffset;
+    }
+
+    // Game time continues from the given time
+    void SetClock(Uint32 time)
+    {
+        pauseTime = time;
+        clockOffset = SDL_GetTicks() - time;
+    }
+
+    // Time left until the simulation changes on its own, a paused game waits for input only
+    Sint32 UntilNextTick()
+    {
+        return paused ? SDL_MAX_SINT32 : (Sint32)(simulation.NextTickTime() - Now());
+    }
+
+    // The first game may have a given seed, the rest get random ones. A watched game starts over.
+    void NewGame()
+    {
+        SaveRecording();
+        SetClock(Now());
+        paused = 0;
+        if (watching)
+        {
+            replayer.Start(&simulation, Now());
+            return;
+        }
+        seed = options.seed >= 0 ? (Uint32)options.seed : (Uint32)rand();
+        options.seed = -1;
+        simulation.Initialize(options.boardColumns, options.boardRows, seed, Now());
+        inputs.Clear();
+        keyframes.Clear();
+        recorded = 0;
+        scored = 0;
+    }
+
+    // Files of recording, watching, scores, checkpoints & telemetry. Playing goes on without keeping scores if their log can't be opened.
+    int OpenFiles()
+    {
+        if (options.scoresPath != NULL)
+        {
+            scores.Open(options.scoresPath);
+        }
+        if (options.checkpointPath != NULL)
+        {
+            checkpoints.Open(options.checkpointPath);
+        }
+        if (options.telemetryPath != NULL && options.watchPath == NULL)
+        {
+            if (telemetry.Open(options.telemetryPath) == 0)
+            {
+                return 0;
+            }
+            simulation.SetTelemetry(telemetry.AddRing());   // The simulation only runs on the main thread
+        }
+        return (options.recordPath == NULL || (recordFile = CreateReplayFile(options.recordPath)) != NULL) &&
+            (options.archivePath == NULL || archive.Open(options.archivePath)) && (options.watchPath == NULL || OpenWatched());
+    }
+
+    // The watched game is read once, its board replaces the one of the options
+    int OpenWatched()
+    {
+        FILE* file = OpenReplayFile(options.watchPath);
+        int games = 0;
+        while (file != NULL && games < options.watchGame && replayer.Load(file))
+        {
+            games++;
+        }
+        if (file != NULL)
+        {
+            fclose(file);
+            if (games < options.watchGame)
             {
-                case UP:
-                    head->y -= SEGMENT_SIZE;
-                    break;
-                case DOWN:
-                    head->y += SEGMENT_SIZE;
-                    break;
-                case LEFT:
-                    head->x -= SEGMENT_SIZE;
-                    break;
-                case RIGHT:
-                    head->x += SEGMENT_SIZE;
-                    break;
+                printf("%s has no game %d\n", options.watchPath, options.watchGame);
+            }
+        }
+        watching = games == options.watchGame;
+        if (watching)
+        {
+            options.boardColumns = replayer.GetHeader()->columns;
+            options.boardRows = replayer.GetHeader()->rows;
+        }
+        return watching;
+    }
+
+    int OpenWindow()
+    {
+        window = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH, WINDOW_HEIGHT, 0);
+        if (window == NULL)
+        {
+            printf("SDL_CreateWindow error: %s\n", SDL_GetError());
+            return 0;
+        }
+        SDL_SetWindowTitle(window, "Snake | Kacper Neumann, 203394");
+        SDL_ShowCursor(options.watchPath != NULL ? SDL_ENABLE : SDL_DISABLE);   // The scrubber is used with the mouse
+        return 1;
+    }
+
+    // Called on the thread that draws, presenting on vsync is preferred, the scheduler falls back to sleeping without it
+    int CreateTarget()
+    {
+        renderer = SDL_CreateRenderer(window, -1, options.vsync ? SDL_RENDERER_PRESENTVSYNC : 0);
+        if (renderer == NULL)
+        {
+            printf("SDL_CreateRenderer error: %s\n", SDL_GetError());
+            return 0;
+        }
+
+        SDL_RendererInfo info;
+        SDL_DisplayMode mode;
+        int refreshRate = 0;
+        if (SDL_GetRendererInfo(renderer, &info) == 0 && (info.flags & SDL_RENDERER_PRESENTVSYNC))
+        {
+            refreshRate = (SDL_GetWindowDisplayMode(window, &mode) == 0 && mode.refresh_rate > 0) ? mode.refresh_rate : 60;
+        }
+        scheduler.Initialize(options.targetFps, refreshRate);
+
+        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
+        SDL_RenderSetLogicalSize(renderer, WINDOW_WIDTH, WINDOW_HEIGHT);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+        return 1;
+    }
+
+    // Only video (which brings events along) is started for a window, backends that draw nothing need events alone.
+    // Audio, joysticks, haptics & game controllers are never used.
+    int CreateOutput()
+    {
+        backend = CreateRenderer(options.renderMode);
+        int windowed = backend->NeedsWindow();
+        if (windowed == 0)
+        {
+            scheduler.Initialize(options.targetFps, 0);
+        }
+        int ready = SDL_Init(windowed ? SDL_INIT_VIDEO : SDL_INIT_EVENTS) == 0;
+        sdlReady = SDL_GetPerformanceCounter();
+        return ready && (windowed == 0 || OpenWindow());
+    }
+
+    // The renderer & backend are created, used and destroyed on the render thread only
+    static int SDLCALL RenderMain(void* data)
+    {
+        Game* game = (Game*)data;
+        game->renderReady = (game->window == NULL || game->CreateTarget()) && game->backend->Initialize(game->renderer, game->options);
+        SDL_SemPost(game->wake);
+        if (game->renderReady)
+        {
+            game->RenderLoop();
+        }
+        delete game->backend;
+        game->backend = NULL;
+        SDL_DestroyRenderer(game->renderer);
+        game->renderer = NULL;
+        return 0;
+    }
+
+    // Draws the newest snapshot as often as the scheduler allows, the Game Over screen only when something changes
+    void RenderLoop()
+    {
+        while (SDL_AtomicGet(&stopRendering) == 0)
+        {
+            int fresh = snapshots.Acquire();
+            const Snapshot* snapshot = snapshots.GetFront();
+            if (snapshot->state == PLAYING)
+            {
+                Uint64 start = SDL_GetPerformanceCounter();
+                drawer.DrawFrame(backend, snapshot, ClockOf(snapshot), options.interpolate);
+                renderTicks += SDL_GetPerformanceCounter() - start;
+                Present();
+                if (++frames == options.maxFrames)
+                {
+                    SDL_Event stop;
+                    stop.type = SDL_QUIT;
+                    SDL_PushEvent(&stop);
+                }
+                scheduler.Wait(snapshot->paused ? SDL_MAX_SINT32 : (Sint32)(snapshot->nextTick - ClockOf(snapshot)));
+            }
+            else if (fresh)
+            {
+                drawer.DrawGameOver(backend, snapshot);
+                Present();
+            }
+            else if (SDL_AtomicSet(&refreshRequested, 0))
+            {
+                backend->Refresh();
+                Present();
             }
+            else
+            {
+                SDL_SemWait(wake);
+            }
+        }
+    }
 
-            lastMoveTime = currentTime;
-			mayChangeDirection = 1;
+    // The first snapshot is published before the thread starts, so it always has one to draw
+    int StartRenderThread()
+    {
+        wake = SDL_CreateSemaphore(0);
+        SDL_AtomicSet(&stopRendering, 0);
+        SDL_AtomicSet(&refreshRequested, 0);
+        Publish();
+        snapshots.Acquire();
+        renderThread = wake != NULL ? SDL_CreateThread(RenderMain, "Render", this) : NULL;
+        if (renderThread == NULL)
+        {
+            printf("SDL_CreateThread error: %s\n", SDL_GetError());
+            return 0;
         }
+        SDL_SemWait(wake);  // Posted once the renderer is ready or has failed
+        return renderReady;
     }
 
-    void AdjustSpeed(float factor)
+    void StopRenderThread()
+    {
+        if (renderThread != NULL)
+        {
+            SDL_AtomicSet(&stopRendering, 1);
+            SDL_SemPost(wake);
+            SDL_WaitThread(renderThread, NULL);
+            renderThread = NULL;
+        }
+        SDL_DestroySemaphore(wake);
+        wake = NULL;
+    }
+
+    static void Mark(Uint64* milestone)
+    {
+        if (*milestone == 0)
+        {
+            *milestone = SDL_GetPerformanceCounter();
+        }
+    }
+
+    // Milliseconds from the start of the program, the first frame counts once it is presented (or drawn without a window)
+    void ReportStartup()
+    {
+        double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+        if (options.benchStartup && firstTick != 0 && firstFrame != 0)
+        {
+            printf("Startup: SDL ready %.3f ms, first tick %.3f ms, first frame %.3f ms\n", (sdlReady - options.launchTime) * ms,
+                (firstTick - options.launchTime) * ms, (firstFrame - options.launchTime) * ms);
+        }
+    }
+
+    void ReportProfile()
+    {
+        double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+        if (steps > 0 && frames > 0)
+        {
+            printf("Simulation: %.3f ms/step, rendering: %.3f ms/frame\n", simulationTicks * ms / steps, renderTicks * ms / frames);
+        }
+    }
+
+    // Draws on the main thread right after each simulation step
+    void RunSerial()
+    {
+        while (quit == 0)
+        {
+            if (simulation.GetState() == GAME_OVER)
+            {
+                scheduler.WaitEvent(&event);    // Block until the next event instead of redrawing the Game Over screen in a loop
+                HandleEvent(&event);
+                continue;
+            }
+
+            Uint64 start = SDL_GetPerformanceCounter();
+            HandleControls();
+            Advance();
+            Publish();
+            snapshots.Acquire();
+            Uint64 simulated = SDL_GetPerformanceCounter();
+            simulationTicks += simulated - start;
+            if (simulation.GetState() == GAME_OVER)
+            {
+                drawer.DrawGameOver(backend, snapshots.GetFront());
+                Present();
+                quit = window == NULL;  // Nobody can restart a headless game
+                continue;
+            }
+
+            drawer.DrawFrame(backend, snapshots.GetFront(), Now(), options.interpolate);
+            renderTicks += SDL_GetPerformanceCounter() - simulated;
+            frames++;
+            Present();
+            if (frames == options.maxFrames)
+            {
+                quit = 1;
+            }
+            scheduler.Wait(UntilNextTick());
+        }
+    }
+
+    // Frames at fixed steps of game time. The simulation catches up with each one tick by tick without
+    // waiting for the clock, so the export runs as fast as drawing allows. Game Over is held for a second.
+    void RunCapture()
+    {
+        int fps = CaptureFps(options);
+        while (quit == 0)
+        {
+            captureTime = (Uint32)((Uint64)frames * 1000 / fps);
+            Uint64 start = SDL_GetPerformanceCounter();
+            HandleControls();
+            Advance();
+            Publish();
+            snapshots.Acquire();
+            Uint64 simulated = SDL_GetPerformanceCounter();
+            simulationTicks += simulated - start;
+
+            for (int i = 0; i < (simulation.GetState() == GAME_OVER ? fps : 1); i++)
+            {
+                simulation.GetState() == GAME_OVER ? drawer.DrawGameOver(backend, snapshots.GetFront()) : drawer.DrawFrame(backend, snapshots.GetFront(), captureTime, options.interpolate);
+                scheduler.Wait(-1);    // Counts the frame, never sleeps
+            }
+            renderTicks += SDL_GetPerformanceCounter() - simulated;
+            Mark(&firstFrame);
+            frames++;
+            quit = simulation.GetState() == GAME_OVER || paused || frames == options.maxFrames;
+        }
+    }
+
+    // Input & simulation never wait for a present, they sleep only until the next event or tick
+    void RunThreaded()
+    {
+        while (quit == 0)
+        {
+            Mark(&firstTick);   // The simulation is advanced only once a step is due, the loop is running already
+            Sint32 timeout = simulation.GetState() == PLAYING ? SDL_max(UntilNextTick(), 0) : -1;
+            if (SDL_WaitEventTimeout(&event, timeout))
+            {
+                HandleEvent(&event);
+                HandleControls();
+            }
+            if (simulation.GetState() == PLAYING)
+            {
+                Uint64 start = SDL_GetPerformanceCounter();
+                Advance();
+                Publish();
+                simulationTicks += SDL_GetPerformanceCounter() - start;
+                quit |= simulation.GetState() == GAME_OVER && window == NULL;
+            }
+        }
+        StopRenderThread();
+    }
+
+public:
+    Game(Options options)
+    {
+		quit = 0;
+		initialized = 0;
+        window = NULL;
+        renderer = NULL;
+        backend = NULL;
+        renderThread = NULL;
+        wake = NULL;
+        this->options = options;
+        frames = 0;
+        steps = 0;
+        simulationTicks = 0;
+        renderTicks = 0;
+        sdlReady = 0;
+        firstTick = 0;
+        firstFrame = 0;
+        zoom = 0;
+        captureTime = 0;
+        recorded = 1;
+        recordFile = NULL;
+        watching = 0;
+        scored = 1;
+        bestCount = 0;
+        paused = 0;
+        scrubbing = 0;
+        clockOffset = 0;
+        pauseTime = 0;
+        if (CreateOutput() == 0)
+        {
+            printf("SDL_Init error: %s\n", SDL_GetError());
+            Cleanup();
+            return;
+        }
+        if (OpenFiles() == 0)
+        {
+            Cleanup();
+            return;
+        }
+
+        NewGame();
+        if (options.renderThread ? StartRenderThread() == 0 :
+            (window != NULL && CreateTarget() == 0) || backend->Initialize(renderer, options) == 0)
+        {
+            Cleanup();
+            return;
+        }
+        initialized = 1;
+    }
+
+    ~Game()
     {
-        moveInterval = (int)(moveInterval * factor);
+        Cleanup();
+    }
+
+	int GetInitialized()
+	{
+		return initialized;
+	}
+
+    void Run()
+    {
+        if (options.capturePath != NULL)
+        {
+            RunCapture();
+        }
+        else
+        {
+            renderThread != NULL ? RunThreaded() : RunSerial();
+        }
+        SaveRecording();
+        scheduler.Report();
+        ReportProfile();
+        ReportStartup();
+    }
+
+    void Cleanup()
+    {
+        StopRenderThread();
+        delete backend;
+        backend = NULL;
+        SDL_DestroyRenderer(renderer);
+        renderer = NULL;
+        SDL_DestroyWindow(window);
+        window = NULL;
+        if (recordFile != NULL)
+        {
+            fclose(recordFile);
+            recordFile = NULL;
+        }
+        archive.Close();
+        checkpoints.Close();
+        telemetry.Close();
+        SDL_Quit();
+    }
+};
+
+// --- BENCHMARKS ---
+void DrawBenchmarkBackground(SDL_Surface* background)
+{
+    SDL_FillRect(background, NULL, MapColor(background, BACKGROUND_COLOR));
+    DrawRectangle(background, 0, 0, background->w, background->h, OUTLINE_COLOR, NO_COLOR);
+}
+
+// Arena-sized scene: every cell of a 4K board holds a segment, food or nothing, plus lines of text
+void BuildBenchmarkScene(DrawList* list, SDL_Surface* background, const Font* font)
+{
+    DrawBenchmarkBackground(background);
+
+    Uint32 random = SeedRandom(1);
+    SDL_Rect all = SurfaceBounds(background);
+    list->AddRestore(&all);
+    for (int y = SEGMENT_SIZE; y + SEGMENT_SIZE < background->h; y += SEGMENT_SIZE)
+    {
+        for (int x = SEGMENT_SIZE; x + SEGMENT_SIZE < background->w; x += SEGMENT_SIZE)
+        {
+            int cell = RandomInt(&random, 0, 9);
+            if (cell < 4)
+            {
+                list->AddRectangle(x, y, SEGMENT_SIZE, SEGMENT_SIZE, NO_COLOR, SNAKE_COLOR);
+            }
+            else if (cell == 4)
+            {
+                list->AddCircle(x + SEGMENT_SIZE / 2, y + SEGMENT_SIZE / 2, SEGMENT_SIZE / 2 - 1, (x / SEGMENT_SIZE) % 2 ? FOOD_COLOR : BONUS_COLOR);
+            }
+        }
+    }
+    for (int y = SEGMENT_SIZE; y + 20 < background->h; y += 100)
+    {
+        list->AddText(SEGMENT_SIZE, y, "'Esc' - Quit  |  'n' - Restart  |  Time: 123.45 s  |  Score: 678", font, GAME_OVER_TEXT_SCALE);
+    }
+}
+
+// Average time of a frame in ms
+double TimeRasterizer(Rasterizer* rasterizer, SDL_Surface* screen, SDL_Surface* background, const DrawList* list)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < BENCH_FRAMES; i++)
+    {
+        rasterizer->Execute(screen, background, list);
+    }
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency() / BENCH_FRAMES;
+}
+
+// Tiled output of 1..N threads is timed and compared with drawing the list directly
+double BenchmarkTiles(int threads, SDL_Surface* screen, SDL_Surface* background, const DrawList* list, SDL_Surface* reference, double single)
+{
+    Rasterizer rasterizer;
+    if (rasterizer.Initialize(threads, 1) == 0)
+    {
+        printf("SDL_CreateThread error: %s\n", SDL_GetError());
+        return 0;
+    }
+
+    SDL_FillRect(screen, NULL, 0x123456);
+    double ms = TimeRasterizer(&rasterizer, screen, background, list);
+    int match = memcmp(screen->pixels, reference->pixels, screen->h * screen->pitch) == 0;
+    printf("Tiled, %2d threads: %8.3f ms/frame, speedup %.2fx, %s\n", threads, ms, single > 0 ? single / ms : 1.0, match ? "matches direct output" : "MISMATCH");
+    return ms;
+}
+
+// Powers of two up to the maximum, speedups are relative to the tiled output of a single thread
+void BenchmarkScaling(int maxThreads, SDL_Surface* screen, SDL_Surface* background, const DrawList* list, SDL_Surface* reference)
+{
+    double single = 0;
+    for (int threads = 1; threads < maxThreads; threads *= 2)
+    {
+        double ms = BenchmarkTiles(threads, screen, background, list, reference, single);
+        single = threads == 1 ? ms : single;
+    }
+    BenchmarkTiles(maxThreads, screen, background, list, reference, single);
+}
+
+// Average time of expanding a whole indexed screen in ms
+double TimeExpansion(PaletteExpander* expander, const SDL_Surface* screen, Uint32* pixels)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < BENCH_FRAMES; i++)
+    {
+        expander->Expand(screen, 0, screen->h, pixels, screen->w * sizeof(Uint32));
     }
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency() / BENCH_FRAMES;
+}
 
-	void Draw(SDL_Surface* screen)
+// Compare tightly packed pixels with a 32-bit surface, alpha is ignored
+int MatchesColors(const Uint32* pixels, const SDL_Surface* reference)
+{
+    for (int y = 0; y < reference->h; y++)
     {
-        for (int i = 0; i < length; i++)
+        const Uint32* row = (const Uint32*)((const Uint8*)reference->pixels + y * reference->pitch);
+        for (int x = 0; x < reference->w; x++)
         {
-            DrawRectangle(screen, body[i].x, body[i].y, SEGMENT_SIZE, SEGMENT_SIZE, NULL, SNAKE_COLOR);
+            if ((pixels[y * reference->w + x] & 0xFFFFFF) != (row[x] & 0xFFFFFF))
+            {
+                return 0;
+            }
         }
     }
-};
+    return 1;
+}
 
-class Game
+// The same list drawn into an indexed back buffer, then expanded as on upload and compared with 32-bit output
+void BenchmarkIndexed(const DrawList* list, SDL_Surface* reference)
 {
-private:
-    SDL_Window* window;
-    SDL_Renderer* renderer;
-    SDL_Surface* screen;
-    SDL_Surface* charset;
-    SDL_Texture* scrtex;
-	SDL_Event event;
-    Snake snake;
-    Segment food;
-    Segment bonus;
-    Uint32 startTime;
-    Uint32 currentTime;
-	Uint32 lastSpeedUpTime;
-	Uint32 lastBonusTime;
-    int points;
-	int bonusActive;
-    int quit;           // Flag to check if the game should end
-	int initialized;    // Flag to check if initialization was successful
+    SDL_Surface* screen = CreateIndexedSurface(BENCH_WIDTH, BENCH_HEIGHT);
+    SDL_Surface* background = CreateIndexedSurface(BENCH_WIDTH, BENCH_HEIGHT);
+    DrawBenchmarkBackground(background);
+    Rasterizer direct;
+    direct.Initialize(1, 0);
+    printf("Direct, 8-bit:     %8.3f ms/frame\n", TimeRasterizer(&direct, screen, background, list));
 
-    void GenerateFood()
+    PaletteExpander expander;
+    expander.Initialize();
+    Uint32* pixels = (Uint32*)malloc(BENCH_WIDTH * BENCH_HEIGHT * sizeof(Uint32));
+    double ms = TimeExpansion(&expander, screen, pixels);
+    int match = MatchesColors(pixels, reference);
+    printf("Expansion, %s: %8.3f ms/frame, %s\n", expander.UsesSimd() ? "SSSE3" : "scalar", ms, match ? "matches 32-bit output" : "MISMATCH");
+
+    free(pixels);
+    SDL_FreeSurface(screen);
+    SDL_FreeSurface(background);
+}
+
+// Compare an RGB565 surface with a 32-bit one reduced to the same format
+int MatchesRGB565(const SDL_Surface* screen, const SDL_Surface* reference)
+{
+    for (int y = 0; y < reference->h; y++)
     {
-        do
+        const Uint16* row = (const Uint16*)((const Uint8*)screen->pixels + y * screen->pitch);
+        const Uint32* expected = (const Uint32*)((const Uint8*)reference->pixels + y * reference->pitch);
+        for (int x = 0; x < reference->w; x++)
         {
-            food.x = LEFT_EDGE + RandomInt(0, (BOARD_WIDTH / SEGMENT_SIZE) - 1) * SEGMENT_SIZE;
-            food.y = TOP_EDGE + RandomInt(0, (BOARD_HEIGHT / SEGMENT_SIZE) - 1) * SEGMENT_SIZE;
-		} while (snake.CollidesWith(food) || (bonus.x == food.x && bonus.y == food.y)); // Prevent from spawning on snake or bonus
+            if (row[x] != FormatRGB565::Map(expected[x] & 0xFFFFFF))
+            {
+                return 0;
+            }
+        }
     }
+    return 1;
+}
 
-    void GenerateBonus()
+// The same list drawn into a 16-bit back buffer, half the memory traffic of the 32-bit one
+void BenchmarkRGB565(const DrawList* list, SDL_Surface* reference)
+{
+    SDL_Surface* screen = CreateRGB565Surface(BENCH_WIDTH, BENCH_HEIGHT);
+    SDL_Surface* background = CreateRGB565Surface(BENCH_WIDTH, BENCH_HEIGHT);
+    DrawBenchmarkBackground(background);
+    Rasterizer direct;
+    direct.Initialize(1, 0);
+    double ms = TimeRasterizer(&direct, screen, background, list);
+    printf("Direct, RGB565:    %8.3f ms/frame, %s\n", ms, MatchesRGB565(screen, reference) ? "matches 32-bit output" : "MISMATCH");
+
+    SDL_FreeSurface(screen);
+    SDL_FreeSurface(background);
+}
+
+int RunRasterBenchmark(Options options)
+{
+    SDL_Surface* screen = CreateSurface(BENCH_WIDTH, BENCH_HEIGHT);
+    SDL_Surface* background = CreateSurface(BENCH_WIDTH, BENCH_HEIGHT);
+    SDL_Surface* reference = CreateSurface(BENCH_WIDTH, BENCH_HEIGHT);
+    DrawList list;
+    BuildBenchmarkScene(&list, background, &CHARSET);
+    printf("%dx%d, %d commands\n", BENCH_WIDTH, BENCH_HEIGHT, list.GetCount());
+
+    Rasterizer direct;
+    direct.Initialize(1, 0);
+    printf("Direct:            %8.3f ms/frame\n", TimeRasterizer(&direct, reference, background, &list));
+    BenchmarkIndexed(&list, reference);
+    BenchmarkRGB565(&list, reference);
+
+    BenchmarkScaling(options.threads > 1 ? options.threads : SDL_GetCPUCount(), screen, background, &list, reference);
+
+    SDL_FreeSurface(screen);
+    SDL_FreeSurface(background);
+    SDL_FreeSurface(reference);
+    return EXIT_SUCCESS;
+}
+
+// Game-sized board full of shapes, added both to a draw list and to a rectangle batch
+void BuildRenderScene(DrawList* list, RectBatch* batch, SDL_Surface* background)
+{
+    SDL_FillRect(background, NULL, BACKGROUND_COLOR);
+    DrawRectangle(background, LEFT_EDGE, TOP_EDGE, BOARD_WIDTH, BOARD_HEIGHT, OUTLINE_COLOR, BACKGROUND_COLOR);
+
+    Uint32 random = SeedRandom(1);
+    SDL_Rect all = SurfaceBounds(background);
+    list->AddRestore(&all);
+    for (int y = TOP_EDGE; y < TOP_EDGE + BOARD_HEIGHT; y += SEGMENT_SIZE)
     {
-        do
+        for (int x = LEFT_EDGE; x < LEFT_EDGE + BOARD_WIDTH; x += SEGMENT_SIZE)
         {
-            bonus.x = LEFT_EDGE + RandomInt(0, (BOARD_WIDTH / SEGMENT_SIZE) - 1) * SEGMENT_SIZE;
-            bonus.y = TOP_EDGE + RandomInt(0, (BOARD_HEIGHT / SEGMENT_SIZE) - 1) * SEGMENT_SIZE;
-		} while (snake.CollidesWith(bonus) || (bonus.x == food.x && bonus.y == food.y));    // Prevent from spawning on snake or food
-        bonusActive = 1;
+            int cell = RandomInt(&random, 0, 9);
+            Uint32 color = (x / SEGMENT_SIZE) % 2 ? FOOD_COLOR : BONUS_COLOR;
+            if (cell < 4)
+            {
+                list->AddRectangle(x, y, SEGMENT_SIZE, SEGMENT_SIZE, NO_COLOR, SNAKE_COLOR);
+                batch->AddRectangle(x, y, SEGMENT_SIZE, SEGMENT_SIZE, NO_COLOR, SNAKE_COLOR);
+            }
+            else if (cell == 4)
+            {
+                list->AddCircle(x + SEGMENT_SIZE / 2, y + SEGMENT_SIZE / 2, SEGMENT_SIZE / 2 - 1, color);
+                batch->AddCircle(x + SEGMENT_SIZE / 2, y + SEGMENT_SIZE / 2, SEGMENT_SIZE / 2 - 1, color);
+            }
+        }
     }
+}
 
-    void DrawBonusProgressBar()
+// Average time of a presented frame in ms: the surface path rasterizes and uploads the whole screen,
+// the batch path copies the unchanged background texture and submits the rectangles
+double TimeRenderer(SDL_Renderer* renderer, SDL_Texture* texture, SDL_Surface* screen, SDL_Surface* background, const DrawList* list, RectBatch* batch)
+{
+    Rasterizer rasterizer;
+    rasterizer.Initialize(1, 0);
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < BENCH_FRAMES; i++)
     {
-        Uint32 elapsedTime = currentTime - lastBonusTime;
-		if (elapsedTime >= BONUS_DURATION)  // Deactivate bonus if expired
+        if (batch == NULL)
         {
-            bonusActive = 0;
+            rasterizer.Execute(screen, background, list);
+            SDL_UpdateTexture(texture, NULL, screen->pixels, screen->pitch);
         }
-        else
+        SDL_RenderCopy(renderer, texture, NULL, NULL);
+        if (batch != NULL)
         {
-			int barWidth = (int)((1.0 - (float)elapsedTime / BONUS_DURATION) * PROGRESS_BAR_WIDTH); // Progress bar is shrinking to 0
-            DrawRectangle(screen, PROGRESS_BAR_X, PROGRESS_BAR_Y, PROGRESS_BAR_WIDTH, PROGRESS_BAR_HEIGHT, OUTLINE_COLOR, NULL);
-            DrawRectangle(screen, PROGRESS_BAR_X, PROGRESS_BAR_Y, barWidth, PROGRESS_BAR_HEIGHT, NULL, BONUS_COLOR);
+            batch->Submit(renderer);
         }
+        SDL_RenderPresent(renderer);
     }
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency() / BENCH_FRAMES;
+}
 
-    void GameOver()
+void BenchmarkRenderDriver(SDL_Window* window, int index, SDL_Surface* screen, SDL_Surface* background, const DrawList* list, RectBatch* batch)
+{
+    SDL_RendererInfo info;
+    SDL_GetRenderDriverInfo(index, &info);
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, index, 0);
+    if (renderer == NULL)
     {
-        while (1)
-        {
-            while (SDL_PollEvent(&event))
-            {
-                switch (event.type)
-                {
-                    case SDL_QUIT:
-                        quit = 1;
-                        return;
-                    case SDL_KEYDOWN:
-                        switch (event.key.keysym.sym)
-                        {
-                            case SDLK_ESCAPE:
-                                quit = 1;
-                                return;
-                            case SDLK_n:
-                                NewGame();
-                                return;
-                        }
-                        break;
-                }
-            }
+        printf("%-12s unavailable: %s\n", info.name, SDL_GetError());
+        return;
+    }
+    SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, screen->w, screen->h);
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_NONE);
+
+    double surface = TimeRenderer(renderer, texture, screen, background, list, NULL);
+    SDL_UpdateTexture(texture, NULL, background->pixels, background->pitch);
+    double rects = TimeRenderer(renderer, texture, screen, background, list, batch);
+    printf("%-12s surface: %8.3f ms/frame, rects: %8.3f ms/frame\n", info.name, surface, rects);
 
-            SDL_FillRect(screen, NULL, BACKGROUND_COLOR);
+    SDL_DestroyTexture(texture);
+    SDL_DestroyRenderer(renderer);
+}
 
-            const char* gameOver = "Game Over!";
-            char score[32];
-            sprintf(score, "Score: %d", points);
-            const char* hint = "Press 'Esc' to Quit or 'n' to Restart";
+// Surface blitting against batched SDL_RenderFillRects on every available render driver
+int RunRenderBenchmark()
+{
+    if (SDL_Init(SDL_INIT_VIDEO) < 0)
+    {
+        printf("SDL_Init error: %s\n", SDL_GetError());
+        return EXIT_FAILURE;
+    }
+    SDL_Window* window = SDL_CreateWindow("Renderer benchmark", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WINDOW_WIDTH, WINDOW_HEIGHT, 0);
+    if (window == NULL)
+    {
+        printf("SDL_CreateWindow error: %s\n", SDL_GetError());
+        SDL_Quit();
+        return EXIT_FAILURE;
+    }
 
-            DrawString(screen, CenterTextX(gameOver, GAME_OVER_TEXT_SCALE), GAME_OVER_TEXT_Y - 50, gameOver, charset, GAME_OVER_TEXT_SCALE);
-            DrawString(screen, CenterTextX(score, GAME_OVER_TEXT_SCALE), GAME_OVER_TEXT_Y, score, charset, GAME_OVER_TEXT_SCALE);
-            DrawString(screen, CenterTextX(hint, GAME_OVER_TEXT_SCALE), GAME_OVER_TEXT_Y + 50, hint, charset, GAME_OVER_TEXT_SCALE);
+    SDL_Surface* screen = CreateSurface(WINDOW_WIDTH, WINDOW_HEIGHT);
+    SDL_Surface* background = CreateSurface(WINDOW_WIDTH, WINDOW_HEIGHT);
+    DrawList list;
+    RectBatch batch;
+    BuildRenderScene(&list, &batch, background);
+    printf("%dx%d, %d shapes, %d rectangles in %d colors\n", WINDOW_WIDTH, WINDOW_HEIGHT, list.GetCount(), batch.GetCount(), batch.GetColorCount());
 
-            RefreshScreen();
-        }
+    for (int i = 0; i < SDL_GetNumRenderDrivers(); i++)
+    {
+        BenchmarkRenderDriver(window, i, screen, background, &list, &batch);
     }
 
-    void HandleControls()
+    SDL_FreeSurface(screen);
+    SDL_FreeSurface(background);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    return EXIT_SUCCESS;
+}
+
+// --- REPLAYS ---
+// Returns 1 if both the game played from the start and the seek to its end stopped at the recorded tick & score
+int CheckReplay(const ReplayHeader* header, const Simulation* played, const Simulation* sought)
+{
+    return played->GetTick() == header->ticks && played->GetPoints() == header->points &&
+        sought->GetTick() == header->ticks && sought->GetPoints() == header->points;
+}
+
+// Plays the loaded game from the start, then seeks a second simulation to its end, which plays on from the last keyframe.
+// The times of both are added up.
+int VerifyReplay(Replayer* replayer, Simulation* played, Simulation* sought, Uint64* elapsed, Uint64* slowestSeek)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    replayer->Play(played);
+    Uint64 playedAt = SDL_GetPerformanceCounter();
+    replayer->Start(sought, 0);
+    replayer->Seek(sought, replayer->GetHeader()->ticks);
+    *elapsed += playedAt - start;
+    *slowestSeek = SDL_max(*slowestSeek, SDL_GetPerformanceCounter() - playedAt);
+    return CheckReplay(replayer->GetHeader(), played, sought);
+}
+
+void ReportReplays(int games, int mismatches, Uint64 ticks, Uint64 elapsed, Uint64 slowestSeek)
+{
+    double ms = 1000.0 / SDL_GetPerformanceFrequency();
+    printf("%d games, %d differ, %llu ticks in %.3f ms: %.2f M ticks/s, slowest seek %.3f ms\n", games, mismatches, (unsigned long long)ticks,
+        elapsed * ms, elapsed > 0 ? ticks / (elapsed * ms) / 1000 : 0.0, slowestSeek * ms);
+}
+
+// Games of an archive that pass the filters, read in place. Only the ones that differ are listed.
+int ReplayArchive(Options options)
+{
+    ArchiveView view;
+    if (view.Open(options.replayPath) == 0)
     {
-        while (SDL_PollEvent(&event))
+        return EXIT_FAILURE;
+    }
+
+    Simulation simulation, seeker;
+    Replayer replayer;
+    int games = 0, mismatches = 0;
+    Uint64 ticks = 0, elapsed = 0, slowestSeek = 0;
+    for (Uint64 i = 0; i < view.GetCount(); i++)
+    {
+        const ArchiveRecord* record = view.GetRecord(i);
+        const Uint8* payload = view.GetPayload(record);
+        if (MatchesFilter(record, &options) && payload != NULL && replayer.Attach(record, payload))
         {
-            switch (event.type)
+            int matches = VerifyReplay(&replayer, &simulation, &seeker, &elapsed, &slowestSeek);
+            if (matches == 0)
             {
-                case SDL_QUIT:
-                    quit = 1;
-                    break;
-                case SDL_KEYDOWN:
-                    switch (event.key.keysym.sym)
-                    {
-                        case SDLK_ESCAPE:
-                            quit = 1;
-                            break;
-                        case SDLK_UP:
-                            snake.SetDirection(UP);
-                            break;
-                        case SDLK_DOWN:
-                            snake.SetDirection(DOWN);
-                            break;
-                        case SDLK_LEFT:
-                            snake.SetDirection(LEFT);
-                            break;
-                        case SDLK_RIGHT:
-                            snake.SetDirection(RIGHT);
-                            break;
-                        case SDLK_n:
-                            NewGame();
-                            break;
-                    }
-                    break;
+                printf("Game %llu: seed %u, %u ticks, %u points, DIFFERS\n", (unsigned long long)i + 1, record->seed, record->ticks, record->points);
             }
+            games++;
+            mismatches += matches == 0;
+            ticks += record->ticks;
         }
     }
+    ReportReplays(games, mismatches, ticks, elapsed, slowestSeek);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-    void HandleBonus()
+// Plays every game of a replay file or archive without a window and checks it ends where it was recorded
+int RunReplay(Options options)
+{
+    if (HasMagic(options.replayPath, ARCHIVE_MAGIC))
     {
-		// Deactivate bonus if expired
-        if (bonusActive && currentTime - lastBonusTime >= BONUS_DURATION)
-        {
-            bonusActive = 0;
-			lastBonusTime = currentTime;
-        }
+        return ReplayArchive(options);
+    }
+    FILE* file = OpenReplayFile(options.replayPath);
+    if (file == NULL)
+    {
+        return EXIT_FAILURE;
+    }
 
-		// Try to generate bonus if the interval has passed
-        if (!bonusActive && currentTime - lastBonusTime >= BONUS_INTERVAL)
-        {
-            if (RandomInt(1, 100) <= BONUS_PROBABILITY)
-            {
-                GenerateBonus();
-            }
-            lastBonusTime = currentTime;
-        }
+    Simulation simulation, seeker;
+    Replayer replayer;
+    int games = 0, mismatches = 0;
+    Uint64 ticks = 0, elapsed = 0, slowestSeek = 0;
+    while (replayer.Load(file))
+    {
+        const ReplayHeader* header = replayer.GetHeader();
+        int matches = VerifyReplay(&replayer, &simulation, &seeker, &elapsed, &slowestSeek);
+        printf("Game %d: seed %u, %d ticks, %d points, %d bytes of input, %d of keyframes, %s\n", ++games, header->seed, simulation.GetTick(),
+            simulation.GetPoints(), header->logLength, header->keyframeLength, matches ? "matches" : "DIFFERS");
+        mismatches += matches == 0;
+        ticks += simulation.GetTick();
+    }
+    fclose(file);
+    ReportReplays(games, mismatches, ticks, elapsed, slowestSeek);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-		// Handle collision if active
-        if (bonusActive && snake.HeadCollidesWith(bonus))
+// Appends every game of a replay file to the archive. Each is played once for the duration & snake length of its record.
+int RunImport(Options options)
+{
+    FILE* file = OpenReplayFile(options.importPath);
+    ArchiveWriter archive;
+    if (file == NULL || archive.Open(options.archivePath) == 0)
+    {
+        if (file != NULL)
         {
-			points += BONUS_POINTS;
-            bonusActive = 0;
-            lastBonusTime = currentTime;
-			if (RandomInt(0, 1) == 0)   // Randomly choose bonus effect
-            {
-                snake.Shrink(BONUS_SHRINK_COUNT);
-            }
-            else
-            {
-                snake.AdjustSpeed(BONUS_SLOW_DOWN_FACTOR);
-            }
+            fclose(file);
         }
+        return EXIT_FAILURE;
     }
 
-    void UpdateScreen()
+    Simulation simulation;
+    Replayer replayer;
+    int games = 0, failed = 0;
+    while (failed == 0 && replayer.Load(file))
     {
-        SDL_FillRect(screen, NULL, BACKGROUND_COLOR);
-
-		float elapsedTime = (currentTime - startTime) * 0.001;  // Convert ms to s
-		char info[256];
-        sprintf(info, "'Esc' - Quit  |  'n' - Restart  |  Time: %.2f s  |  Score: %d  |  Implemented Requirements: 1, 2, 3, 4, A, B, C, D", elapsedTime, points);
-
-        // Draw info panel
-        DrawString(screen, CenterTextX(info, 1), INFO_PANEL_TEXT_Y, info, charset, INFO_PANEL_TEXT_SCALE);
-        DrawRectangle(screen, 0, INFO_PANEL_Y, WINDOW_WIDTH, INFO_PANEL_HEIGHT, OUTLINE_COLOR, BACKGROUND_COLOR);
-
-        // Draw game board
-        DrawRectangle(screen, LEFT_EDGE, TOP_EDGE, BOARD_WIDTH, BOARD_HEIGHT, OUTLINE_COLOR, BACKGROUND_COLOR);
+        const ReplayHeader* header = replayer.GetHeader();
+        replayer.Play(&simulation);
+        failed = archive.Append(header, &simulation, replayer.GetData(), replayer.GetData() + header->logLength) == 0;
+        games += failed == 0;
+    }
+    fclose(file);
+    printf("Imported %d games, the archive holds %llu\n", games, (unsigned long long)archive.GetCount());
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
 
-		// Draw food
-        DrawCircle(screen, food.x + SEGMENT_SIZE / 2, food.y + SEGMENT_SIZE / 2, SEGMENT_SIZE / 2 - 1, FOOD_COLOR);
+// Games of an archive that pass the filters, found by scanning the index only
+int RunQuery(Options options)
+{
+    ArchiveView view;
+    if (view.Open(options.queryPath) == 0)
+    {
+        return EXIT_FAILURE;
+    }
 
-		// Draw bonus
-        if (bonusActive)
+    Uint64 start = SDL_GetPerformanceCounter(), matches = 0;
+    for (Uint64 i = 0; i < view.GetCount(); i++)
+    {
+        const ArchiveRecord* record = view.GetRecord(i);
+        if (MatchesFilter(record, &options) && ++matches <= ARCHIVE_LIST_LIMIT)
         {
-            DrawCircle(screen, bonus.x + SEGMENT_SIZE / 2, bonus.y + SEGMENT_SIZE / 2, SEGMENT_SIZE / 2 - 1, BONUS_COLOR);
-			DrawBonusProgressBar();
+            printf("Game %llu: seed %u, %u points, length %u, %u ticks, %.2f s\n", (unsigned long long)i + 1, record->seed,
+                record->points, record->length, record->ticks, record->duration / 1000.0);
         }
-		
-        snake.Draw(screen);
+    }
+    double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+    printf("%llu of %llu games match, index scanned in %.3f ms\n", (unsigned long long)matches, (unsigned long long)view.GetCount(), ms);
+    return EXIT_SUCCESS;
+}
 
-        RefreshScreen();
+// Plays an archived game tick by tick & tells how it ended. A snake only dies on a move, which goes the way the player
+// or the edge turned it, or straight on.
+DeathCause AnalyzeGame(Replayer* replayer, Simulation* simulation)
+{
+    replayer->Start(simulation, 0);
+    int turned = 0;
+    Direction heading = simulation->GetDirection();
+    while (simulation->GetTick() < replayer->GetHeader()->ticks && simulation->GetState() == PLAYING)
+    {
+        replayer->Turn(simulation);
+        turned = simulation->HasTurned();
+        heading = simulation->GetDirection();
+        simulation->Step();
+    }
+    if (simulation->GetState() != GAME_OVER)
+    {
+        return DEATH_NONE;
     }
+    return turned ? DEATH_TURNED : simulation->GetDirection() != heading ? DEATH_EDGE : DEATH_STRAIGHT;
+}
 
-    void RefreshScreen()
+// Statistics per board, ordered by board size
+class BoardTable
+{
+private:
+    BoardStats* boards;
+    int count;
+
+public:
+    BoardTable()
     {
-        SDL_UpdateTexture(scrtex, NULL, screen->pixels, screen->pitch);
-        SDL_RenderCopy(renderer, scrtex, NULL, NULL);
-        SDL_RenderPresent(renderer);
+        boards = NULL;
+        count = 0;
     }
 
-    void NewGame()
+    ~BoardTable()
     {
-        snake.Initialize();
-        GenerateFood();
-        startTime = SDL_GetTicks();
-        lastSpeedUpTime = startTime;
-		bonusActive = 0;
-        points = 0;
+        free(boards);
     }
 
-public:
-    Game()
+    // A board seen for the first time starts empty
+    BoardStats* Find(Uint32 columns, Uint32 rows)
     {
-		quit = 0;
-		initialized = 0;
-        if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
+        int at = 0;
+        while (at < count && (boards[at].columns < columns || (boards[at].columns == columns && boards[at].rows < rows)))
         {
-            printf("SDL_Init error: %s\n", SDL_GetError());
-            return;
+            at++;
+        }
+        if (at == count || boards[at].columns != columns || boards[at].rows != rows)
+        {
+            boards = (BoardStats*)realloc(boards, (count + 1) * sizeof(BoardStats));
+            memmove(&boards[at + 1], &boards[at], (count - at) * sizeof(BoardStats));
+            memset(&boards[at], 0, sizeof(BoardStats));
+            boards[at].columns = columns;
+            boards[at].rows = rows;
+            count++;
         }
+        return &boards[at];
+    }
 
-        if (SDL_CreateWindowAndRenderer(WINDOW_WIDTH, WINDOW_HEIGHT, 0, &window, &renderer) != 0)
+    // Reduce step: the tables of another thread are added to these
+    void Add(const BoardTable* other)
+    {
+        for (int i = 0; i < other->count; i++)
         {
-            printf("SDL_CreateWindowAndRenderer error: %s\n", SDL_GetError());
-            SDL_Quit();
-            return;
+            const BoardStats* from = &other->boards[i];
+            BoardStats* to = Find(from->columns, from->rows);
+            to->games += from->games;
+            to->ticks += from->ticks;
+            for (int cause = 0; cause < DEATH_CAUSES; cause++)
+            {
+                to->causes[cause] += from->causes[cause];
+            }
+            for (int bucket = 0; bucket < ANALYTICS_BUCKETS; bucket++)
+            {
+                to->deathTicks[bucket] += from->deathTicks[bucket];
+                to->scores[bucket] += from->scores[bucket];
+                to->lengths[bucket] += from->lengths[bucket];
+            }
         }
+    }
 
-        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
-        SDL_RenderSetLogicalSize(renderer, WINDOW_WIDTH, WINDOW_HEIGHT);
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_SetWindowTitle(window, "Snake | Kacper Neumann, 203394");
-        SDL_ShowCursor(SDL_DISABLE);
+    int GetCount() const { return count; }
+    const BoardStats* GetBoard(int index) const { return &boards[index]; }
+};
 
-        screen = SDL_CreateRGBSurface(0, WINDOW_WIDTH, WINDOW_HEIGHT, 32, 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000);
-        scrtex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, WINDOW_WIDTH, WINDOW_HEIGHT);
+// Map step: a thread claims chunks of the archive's games & plays them into tables of its own, so threads share
+// nothing but the chunk counter & the read-only mapping
+class AnalysisWorker
+{
+private:
+    const ArchiveView* view;
+    const Options* options;
+    SDL_atomic_t* nextGame;
+    Simulation simulation;
+    Replayer replayer;
 
-        charset = SDL_LoadBMP("cs8x8.bmp");
-        if (charset == NULL)
+    void Analyze(const ArchiveRecord* record)
+    {
+        const Uint8* payload = view->GetPayload(record);
+        if (MatchesFilter(record, options) == 0 || payload == NULL || replayer.Attach(record, payload) == 0)
         {
-            printf("SDL_LoadBMP(cs8x8.bmp) error: %s\n", SDL_GetError());
-            Cleanup();
             return;
         }
-        SDL_SetColorKey(charset, 1, 0x000000);
-
-        NewGame();
-        initialized = 1;
+        DeathCause cause = AnalyzeGame(&replayer, &simulation);
+        BoardStats* stats = boards.Find(record->columns, record->rows);
+        stats->games++;
+        stats->ticks += simulation.GetTick();
+        stats->causes[cause]++;
+        if (cause != DEATH_NONE)
+        {
+            stats->deathTicks[BucketOf(simulation.GetTick())]++;
+        }
+        stats->scores[BucketOf(simulation.GetPoints())]++;
+        stats->lengths[BucketOf(simulation.GetLength())]++;
+        mismatches += (Uint32)simulation.GetTick() != record->ticks || (Uint32)simulation.GetPoints() != record->points;
     }
 
-    ~Game()
+    static int SDLCALL WorkerMain(void* data)
     {
-        Cleanup();
+        ((AnalysisWorker*)data)->Run();
+        return 0;
     }
 
-	int GetInitialized()
-	{
-		return initialized;
-	}
+public:
+    BoardTable boards;
+    Uint64 mismatches;  // Games that ended elsewhere than their records say
+    SDL_Thread* thread;
+
+    // Returns 0 if the thread can't be created, Run then plays the chunks left on the calling thread
+    int Start(const ArchiveView* archive, const Options* filters, SDL_atomic_t* counter)
+    {
+        view = archive;
+        options = filters;
+        nextGame = counter;
+        mismatches = 0;
+        thread = SDL_CreateThread(WorkerMain, "Analysis", this);
+        return thread != NULL;
+    }
 
     void Run()
     {
-        while (quit == 0)
+        int count = (int)view->GetCount();
+        int first;
+        while ((first = SDL_AtomicAdd(nextGame, ANALYTICS_CHUNK)) < count)
         {
-            HandleControls();
-
-            currentTime = SDL_GetTicks();
-			if (currentTime - lastSpeedUpTime >= SPEED_UP_INTERVAL) // Speed up
+            for (int i = first; i < SDL_min(first + ANALYTICS_CHUNK, count); i++)
             {
-                snake.AdjustSpeed(SPEED_UP_FACTOR);
-                lastSpeedUpTime = currentTime;
+                Analyze(view->GetRecord(i));
             }
+        }
+    }
+};
 
-            HandleBonus();
-
-			if (snake.HeadCollidesWith(food))   // Handle food collision
-            {
-                snake.Grow();
-                GenerateFood();
-				points += FOOD_POINTS;
-            }
+// Histograms of one board side by side, a row per power of two up to the last one used
+void ReportHistograms(const BoardStats* stats)
+{
+    printf("%24s %12s %12s %12s\n", "", "death tick", "score", "length");
+    int last = 0;
+    for (int bucket = 0; bucket < ANALYTICS_BUCKETS; bucket++)
+    {
+        last = stats->deathTicks[bucket] + stats->scores[bucket] + stats->lengths[bucket] > 0 ? bucket : last;
+    }
+    for (int bucket = 0; bucket <= last; bucket++)
+    {
+        char range[32];
+        Uint32 low = bucket > 0 ? 1u << (bucket - 1) : 0;
+        SDL_snprintf(range, sizeof(range), "%u-%u", low, bucket > 0 ? low * 2 - 1 : 0);
+        printf("%24s %12llu %12llu %12llu\n", range, (unsigned long long)stats->deathTicks[bucket],
+            (unsigned long long)stats->scores[bucket], (unsigned long long)stats->lengths[bucket]);
+    }
+}
 
-			snake.Move(currentTime);    // Move & check for collision with itself
-            if (snake.SelfCollision())
-            {
-                GameOver();
-            }
+// Boards in order of size: their games by how they ended, then the histograms. Throughput is counted over all boards.
+void ReportAnalysis(const BoardTable* total, Uint64 mismatches, int threads, double seconds)
+{
+    Uint64 games = 0, ticks = 0;
+    for (int i = 0; i < total->GetCount(); i++)
+    {
+        const BoardStats* stats = total->GetBoard(i);
+        const Uint64* causes = stats->causes;
+        printf("Board %ux%u: %llu games, %llu ticks. Died after a turn %llu, at an edge %llu, going straight %llu, unfinished %llu\n",
+            stats->columns, stats->rows, (unsigned long long)stats->games, (unsigned long long)stats->ticks, (unsigned long long)causes[DEATH_TURNED],
+            (unsigned long long)causes[DEATH_EDGE], (unsigned long long)causes[DEATH_STRAIGHT], (unsigned long long)causes[DEATH_NONE]);
+        ReportHistograms(stats);
+        games += stats->games;
+        ticks += stats->ticks;
+    }
+    printf("%llu games (%llu differ from their records) on %d threads in %.3f s: %.0f games/s, %.2f M ticks/s\n", (unsigned long long)games,
+        (unsigned long long)mismatches, threads, seconds, seconds > 0 ? games / seconds : 0.0, seconds > 0 ? ticks / seconds / 1e6 : 0.0);
+}
 
-            UpdateScreen();
-        }
+// Every game of an archive that passes the filters is played again on all cores, the per-thread tables are added up
+int RunAnalysis(Options options)
+{
+    ArchiveView view;
+    if (view.Open(options.analyzePath) == 0)
+    {
+        return EXIT_FAILURE;
     }
 
-    void Cleanup()
+    int threads = options.threads > 1 ? options.threads : SDL_GetCPUCount();
+    AnalysisWorker* workers = new AnalysisWorker[threads];
+    SDL_atomic_t nextGame;
+    SDL_AtomicSet(&nextGame, 0);
+    Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < threads; i++)
     {
-        SDL_FreeSurface(charset);
-        SDL_FreeSurface(screen);
-        SDL_DestroyTexture(scrtex);
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        SDL_Quit();
+        workers[i].Start(&view, &options, &nextGame);
     }
-};
+    BoardTable total;
+    Uint64 mismatches = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        if (workers[i].thread != NULL)
+        {
+            SDL_WaitThread(workers[i].thread, NULL);
+        }
+        else
+        {
+            workers[i].Run();   // Without a thread of its own, whatever is left is played here
+        }
+        total.Add(&workers[i].boards);
+        mismatches += workers[i].mismatches;
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    delete[] workers;
+    ReportAnalysis(&total, mismatches, threads, seconds);
+    return mismatches == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
 // --- MAIN PROGRAM ---
 int main(int argc, char** argv)
 {
     srand(time(NULL));
 
-    Game game;
+    Options options;
+    options.launchTime = SDL_GetPerformanceCounter();
+    ParseOptions(argc, argv, &options);
+    if (options.fontPath != NULL)
+    {
+        return RunFontTable(options.fontPath);
+    }
+    if (options.benchRaster)
+    {
+        return RunRasterBenchmark(options);
+    }
+    if (options.benchRender)
+    {
+        return RunRenderBenchmark();
+    }
+    if (options.replayPath != NULL)
+    {
+        return RunReplay(options);
+    }
+    if (options.importPath != NULL && options.archivePath != NULL)
+    {
+        return RunImport(options);
+    }
+    if (options.queryPath != NULL)
+    {
+        return RunQuery(options);
+    }
+    if (options.analyzePath != NULL)
+    {
+        return RunAnalysis(options);
+    }
+
+    Game game(options);
 	if (game.GetInitialized() == 0) // Initialization failed
     {
 		return EXIT_FAILURE;